@@ -3,14 +3,18 @@
 
 /* 
  * A buffer is a container of normalized dependencies.  It is a queue or
- * vector, depending on the mode in which Stu is run, i.e., whether
- * targets are built in depth-first order (the default), or in random
- * order.  Which is used is determined by the global variable OPTION_VEC
- * defined in global.hh, which is set once before any Buffer object is
- * created.
+ * a set from which elements are removed in random order, depending on
+ * the mode in which Stu is run, i.e., whether targets are built in
+ * depth-first order (the default), or in random order.  Which is used
+ * is determined by the global variable OPTION_VEC defined in global.hh,
+ * which is set once before any Buffer object is created.
+ *
+ * Both are implemented with a single vector.  A queue is not
+ * implemented using std::queue, because each std::deque allocates a
+ * large block even when it is empty, and there are two buffers in
+ * each execution.
  */
 
-#include <queue>
 #include <random>
 
 static default_random_engine buffer_generator;
@@ -28,61 +32,151 @@ size_t random_number(size_t n)
 class Buffer
 {
 private:
-	/* Since we only ever use one of the two, we could use a
-	 * union-like data structure, but we don't in this
-	 * implementation  */   
-
 	/* All contained dependencies are normalized */
 
-	queue <shared_ptr <const Dep> > q;
 	vector <shared_ptr <const Dep> > v;
+	/* Null entries stand for an element of PRODUCTS */
+
+	size_t begin= 0;
+	/* In queue mode, the index of the first element in V.  Elements
+	 * before it have already been removed.  Always zero in random
+	 * mode.  */
+
+	struct Product {
+		shared_ptr <const Concat_Dep> dep;
+		vector <vector <shared_ptr <const Dep> > > parts;
+		vector <size_t> indices;
+		/* Of the next dependency to generate */ 
+	};
+
+	vector <Product> products; 
+	/* Concatenations whose normalized dependencies are generated
+	 * only when they are removed from the buffer, such that large
+	 * concatenations are never held in memory as a whole.  Each
+	 * product corresponds to one null entry in V, in the same
+	 * order in queue mode.  */ 
+
+	shared_ptr <const Dep> next_product(size_t i, bool &exhausted)
+	/* Generate the next dependency of PRODUCTS[I], and set EXHAUSTED
+	 * when it was the last one */ 
+	{
+		Product &product= products[i];
+		shared_ptr <const Dep> ret= Concat_Dep::get_product
+			(product.dep, product.parts, product.indices); 
+		assert(ret->is_normalized()); 
+		exhausted= true; 
+		for (size_t k= product.indices.size();  k--; ) {
+			if (++product.indices[k] < product.parts[k].size()) {
+				exhausted= false; 
+				break; 
+			}
+			product.indices[k]= 0; 
+		}
+		return ret; 
+	}
 
 public:
 
 	size_t size() const {
-		if (order_vec) 
-			return v.size();
-		else
-			return q.size();
+		size_t ret= v.size() - begin - products.size(); 
+		for (const Product &product:  products) {
+			size_t count= 1, count_done= 0; 
+			for (size_t k= 0;  k < product.parts.size();  ++k) {
+				count *= product.parts[k].size(); 
+				count_done= count_done * product.parts[k].size()
+					+ product.indices[k]; 
+			}
+			ret += count - count_done; 
+		}
+		return ret; 
 	}
 
 	shared_ptr <const Dep> next() 
 	/* Return the next element, removing it from the buffer at the
 	 * same time  */
 	{
+		bool exhausted; 
 		if (order_vec) {
 			size_t s= v.size();
 			size_t k= random_number(s);
+			if (v[k] == nullptr) {
+				/* In random mode, the null entries of V are
+				 * not in the order of PRODUCTS, and any
+				 * product may be used */ 
+				size_t i= random_number(products.size()); 
+				shared_ptr <const Dep> ret= next_product(i, exhausted); 
+				if (! exhausted)
+					return ret; 
+				if (i + 1 < products.size())
+					swap(products[i], products.back()); 
+				products.pop_back(); 
+				v[k]= move(ret); 
+			}
 			if (k + 1 < s) 
 				swap(v[k], v[s - 1]); 
-			shared_ptr <const Dep> ret= v[s - 1];
+			shared_ptr <const Dep> ret= move(v[s - 1]);
 			v.resize(s - 1); 
 			return ret; 
 		} else {
-			shared_ptr <const Dep> ret= q.front();
-			q.pop(); 
+			assert(begin < v.size()); 
+			if (v[begin] == nullptr) {
+				shared_ptr <const Dep> ret= next_product(0, exhausted); 
+				if (! exhausted)
+					return ret; 
+				products.erase(products.begin()); 
+				v[begin]= move(ret); 
+			}
+			shared_ptr <const Dep> ret= move(v[begin++]);
+			if (begin == v.size()) {
+				/* Keep the allocated capacity */
+				v.clear();
+				begin= 0; 
+			} else if (begin >= 32 && 2 * begin >= v.size()) {
+				/* Remove the already-removed elements when they
+				 * make up at least half of V, so that the
+				 * amortized cost remains constant */
+				v.erase(v.begin(), v.begin() + begin);
+				begin= 0; 
+			}
 			return ret; 
 		}
 	}
 
-	void push(shared_ptr <const Dep> d)
+	void push(const shared_ptr <const Dep> &d)
 	/* Add to the end of the queue (if sorted, otherwise, just
 	 * add) */ 
 	{
 		assert(d->is_normalized()); 
-		if (order_vec) {
-			v.emplace_back(d); 
-		} else {
-			q.push(d); 
+		v.emplace_back(d); 
+	}
+
+	void push_product(const shared_ptr <const Concat_Dep> &dep,
+			  vector <vector <shared_ptr <const Dep> > > &&parts)
+	/* Add all normalized dependencies of the concatenation DEP,
+	 * given by PARTS as returned by Concat_Dep::split_concat(), in
+	 * the same order as Concat_Dep::normalize_concat().  */ 
+	{
+		for (const auto &part:  parts) {
+			if (part.empty())
+				return; 
 		}
+		products.emplace_back(); 
+		products.back().dep= dep; 
+		products.back().indices.resize(parts.size(), 0); 
+		products.back().parts= move(parts); 
+		v.emplace_back(nullptr); 
 	}
 
 	bool empty() const {
-		if (order_vec) {
-			return v.empty();
-		} else {
-			return q.empty(); 
-		}
+		return v.size() == begin; 
+	}
+
+	void shrink() 
+	/* Remove all elements and free the allocated memory */
+	{
+		vector <shared_ptr <const Dep> > ().swap(v); 
+		vector <Product> ().swap(products); 
+		begin= 0; 
 	}
 };
 
@@ -0,0 +1,387 @@
+#ifndef CACHE_HH
+#define CACHE_HH
+
+/*
+ * The cache of parsed dynamic dependencies, enabled with the -D option.
+ * For each file that is read as a dynamic dependency, the list of
+ * dependencies it contains is saved together with the signature of the
+ * file, i.e., its device, inode, size and modification time.  When the
+ * same file is read again with the same signature, the saved list is
+ * used and the file is neither read nor parsed.
+ *
+ * Only lists of plain dependencies are cached.  This includes
+ * everything that can be declared in files read with the flags -n, -0
+ * and -d.  Files that contain other constructs (concatenations, nested
+ * dynamic dependencies, variable dependencies, etc.), and files that
+ * contain errors, are parsed each time.  A file is also not cached when
+ * it was modified after Stu was started, because its signature may
+ * then not change on a subsequent modification within the resolution
+ * of the file system's timestamps.
+ *
+ * The cache file is read when the -D option is processed, and written
+ * back when Stu exits, by writing a temporary file and renaming it.  An
+ * invalid cache file is treated like an empty one.  The format of the
+ * file is binary and specific to the machine.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <unordered_map>
+
+#include "dep.hh"
+#include "timestamp.hh"
+
+class Dynamic_Cache
+{
+public:
+	static void load(const char *filename);
+	/* Enable the cache and read the given cache file.  A nonexistent
+	 * file is equivalent to an empty cache.  Called when the -D
+	 * option is processed.  */
+
+	static bool enabled() {  return ! filename.empty();  }
+
+	static bool get(const string &name,
+			Flags flags,
+			const struct stat *buf,
+			vector <shared_ptr <const Dep> > &deps);
+	/* If the file NAME, read with the given attribute FLAGS, is in
+	 * the cache with the signature from BUF, add its dependencies
+	 * to DEPS and return TRUE.  Otherwise, return FALSE.  */
+
+	static void put(const string &name,
+			Flags flags,
+			const struct stat *buf,
+			const vector <shared_ptr <const Dep> > &deps);
+	/* Save the result of parsing the file NAME, when possible.  BUF
+	 * must be the result of stat() from before the file was read.  */
+
+	static void save();
+	/* Write back the cache file if it was changed */
+
+private:
+	struct Entry {
+		uint64_t dev, ino, size, mtime_sec, mtime_nsec;
+		Flags flags;
+		vector <shared_ptr <const Dep> > deps;
+		/* All of type Plain_Dep */
+	};
+
+	static string filename;
+	/* Empty when the cache is not used */
+
+	static unordered_map <string, Entry> entries;
+	/* By filename */
+
+	static bool changed;
+
+	static string get_magic();
+	/* The first line of the cache file.  The flags are saved as
+	 * bits, and therefore the magic contains the list of flags, so
+	 * that a cache file written by a version of Stu with other
+	 * flags is not used.  */
+
+	static void set_signature(Entry &entry, const struct stat *buf);
+	static bool is_cacheable(const string &name, const Place &place);
+
+	static void write_u64(string &out, uint64_t x) {
+		out.append((const char *) &x, sizeof(x));
+	}
+	static void write_string(string &out, const string &s) {
+		write_u64(out, s.size());
+		out += s;
+	}
+	static void write_place(string &out, const Place &place);
+
+	static bool read_u64(const char *&p, const char *p_end, uint64_t &x);
+	static bool read_string(const char *&p, const char *p_end, string &s);
+	static bool read_place(const char *&p, const char *p_end,
+			       const Place &place_file, Place &place);
+	/* The read functions return FALSE when the input is truncated or
+	 * invalid */
+};
+
+string Dynamic_Cache::filename;
+unordered_map <string, Dynamic_Cache::Entry> Dynamic_Cache::entries;
+bool Dynamic_Cache::changed= false;
+
+void Dynamic_Cache::load(const char *filename_)
+{
+	assert(filename_ != nullptr && *filename_ != '\0');
+	filename= filename_;
+	entries.clear();
+
+	int fd= open(filename_, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return;
+		print_error_system(filename_);
+		exit(ERROR_FATAL);
+	}
+
+	string in;
+	char b[1 << 16];
+	ssize_t r;
+	while ((r= read(fd, b, sizeof(b))) > 0)
+		in.append(b, r);
+	if (r < 0) {
+		print_error_system(filename_);
+		exit(ERROR_FATAL);
+	}
+	close(fd);
+
+	const char *p= in.c_str(), *const p_end= p + in.size();
+	const string magic= get_magic();
+	if (in.compare(0, magic.size(), magic))
+		return;
+	p += magic.size();
+
+	while (p < p_end) {
+		string name;
+		Entry entry;
+		uint64_t flags, count;
+		if (! (read_string(p, p_end, name) &&
+		       read_u64(p, p_end, entry.dev) &&
+		       read_u64(p, p_end, entry.ino) &&
+		       read_u64(p, p_end, entry.size) &&
+		       read_u64(p, p_end, entry.mtime_sec) &&
+		       read_u64(p, p_end, entry.mtime_nsec) &&
+		       read_u64(p, p_end, flags) &&
+		       read_u64(p, p_end, count)))
+			goto invalid;
+		entry.flags= flags;
+		const Place place_file(Place::Type::INPUT_FILE, name, 1, 0);
+		for (uint64_t i= 0;  i < count;  ++i) {
+			uint64_t flags_dep, flags_target;
+			Place places[C_PLACED];
+			Place place, place_target, place_name;
+			string text;
+			if (! read_u64(p, p_end, flags_dep))
+				goto invalid;
+			for (unsigned j= 0;  j < C_PLACED;  ++j) {
+				if ((flags_dep & (1 << j)) &&
+				    ! read_place(p, p_end, place_file, places[j]))
+					goto invalid;
+			}
+			if (! (read_u64(p, p_end, flags_target) &&
+			       (flags_target & ~F_TARGET_TRANSIENT) == 0 &&
+			       read_string(p, p_end, text) &&
+			       read_place(p, p_end, place_file, place_name) &&
+			       read_place(p, p_end, place_file, place_target) &&
+			       read_place(p, p_end, place_file, place)))
+				goto invalid;
+			Place_Name pn(text);
+			pn.place= place_name;
+			shared_ptr <Plain_Dep> dep= make_shared <Plain_Dep>
+				(flags_dep, places,
+				 Place_Param_Target(flags_target, pn, place_target));
+			dep->place= place;
+			entry.deps.push_back(dep);
+		}
+		entries[name]= entry;
+	}
+	return;
+
+ invalid:
+	entries.clear();
+}
+
+bool Dynamic_Cache::get(const string &name,
+			Flags flags,
+			const struct stat *buf,
+			vector <shared_ptr <const Dep> > &deps)
+{
+	assert(enabled());
+	auto i= entries.find(name);
+	if (i == entries.end())
+		return false;
+	Entry signature;
+	set_signature(signature, buf);
+	const Entry &entry= i->second;
+	if (entry.flags != flags ||
+	    entry.dev != signature.dev ||
+	    entry.ino != signature.ino ||
+	    entry.size != signature.size ||
+	    entry.mtime_sec != signature.mtime_sec ||
+	    entry.mtime_nsec != signature.mtime_nsec)
+		return false;
+	deps.insert(deps.end(), entry.deps.begin(), entry.deps.end());
+	return true;
+}
+
+void Dynamic_Cache::put(const string &name,
+			Flags flags,
+			const struct stat *buf,
+			const vector <shared_ptr <const Dep> > &deps)
+{
+	assert(enabled());
+
+	/* A file modified during this run may be modified again without
+	 * changing its signature */
+	if (! (Timestamp(buf) < Timestamp::startup)) {
+		if (entries.erase(name))
+			changed= true;
+		return;
+	}
+
+	Entry entry;
+	set_signature(entry, buf);
+	entry.flags= flags;
+	for (const auto &d:  deps) {
+		shared_ptr <const Plain_Dep> plain_dep= to <Plain_Dep> (d);
+		if (plain_dep == nullptr ||
+		    (plain_dep->flags & F_VARIABLE) ||
+		    ! plain_dep->variable_name.empty() ||
+		    plain_dep->place_param_target.place_name.get_n() != 0)
+			return;
+		for (unsigned j= 0;  j < C_PLACED;  ++j) {
+			if ((plain_dep->flags & (1 << j)) &&
+			    ! is_cacheable(name, plain_dep->get_place_flag(j)))
+				return;
+		}
+		if (! is_cacheable(name, plain_dep->place_param_target.place_name.place) ||
+		    ! is_cacheable(name, plain_dep->place_param_target.place) ||
+		    ! is_cacheable(name, plain_dep->place))
+			return;
+		entry.deps.push_back(d);
+	}
+	entries[name]= entry;
+	changed= true;
+}
+
+void Dynamic_Cache::save()
+{
+	if (! changed)
+		return;
+	assert(enabled());
+
+	string out= get_magic();
+	for (const auto &i:  entries) {
+		const Entry &entry= i.second;
+		write_string(out, i.first);
+		write_u64(out, entry.dev);
+		write_u64(out, entry.ino);
+		write_u64(out, entry.size);
+		write_u64(out, entry.mtime_sec);
+		write_u64(out, entry.mtime_nsec);
+		write_u64(out, entry.flags);
+		write_u64(out, entry.deps.size());
+		for (const auto &d:  entry.deps) {
+			shared_ptr <const Plain_Dep> plain_dep= to <Plain_Dep> (d);
+			const Place_Param_Target &place_param_target=
+				plain_dep->place_param_target;
+			write_u64(out, plain_dep->flags);
+			for (unsigned j= 0;  j < C_PLACED;  ++j) {
+				if (plain_dep->flags & (1 << j))
+					write_place(out, plain_dep->get_place_flag(j));
+			}
+			write_u64(out, place_param_target.flags);
+			write_string(out, place_param_target.place_name.unparametrized());
+			write_place(out, place_param_target.place_name.place);
+			write_place(out, place_param_target.place);
+			write_place(out, plain_dep->place);
+		}
+	}
+
+	/* Write to a temporary file in the same directory, so that
+	 * concurrent runs of Stu never see a partial cache file.  The
+	 * name of the temporary file is different for each process.  */
+	string filename_tmp= filename + frmt(".%ld", (long) getpid());
+	int fd= creat(filename_tmp.c_str(), 0666);
+	if (fd < 0)
+		goto error;
+	for (size_t k= 0;  k < out.size();) {
+		ssize_t r= write(fd, out.c_str() + k, out.size() - k);
+		if (r < 0) {
+			close(fd);
+			goto error;
+		}
+		k += r;
+	}
+	if (close(fd) < 0 ||
+	    rename(filename_tmp.c_str(), filename.c_str()) < 0)
+		goto error;
+	changed= false;
+	return;
+
+ error:
+	print_error_system(filename_tmp);
+	unlink(filename_tmp.c_str());
+	exit(ERROR_FATAL);
+}
+
+string Dynamic_Cache::get_magic()
+{
+	return frmt("stu-dynamic-cache-2 %s %u\n", FLAGS_CHARS, (unsigned) C_WORD);
+}
+
+void Dynamic_Cache::set_signature(Entry &entry, const struct stat *buf)
+{
+	entry.dev= buf->st_dev;
+	entry.ino= buf->st_ino;
+	entry.size= buf->st_size;
+	entry.mtime_sec= buf->st_mtime;
+#if USE_MTIM
+	entry.mtime_nsec= buf->st_mtim.tv_nsec;
+#else
+	entry.mtime_nsec= 0;
+#endif
+}
+
+bool Dynamic_Cache::is_cacheable(const string &name, const Place &place)
+/* Places are saved as line/column only, and must therefore be within
+ * the file itself */
+{
+	return place.type == Place::Type::EMPTY ||
+		(place.type == Place::Type::INPUT_FILE && place.get_text() == name);
+}
+
+void Dynamic_Cache::write_place(string &out, const Place &place)
+{
+	if (place.type == Place::Type::EMPTY) {
+		write_u64(out, 0);
+	} else {
+		assert(place.type == Place::Type::INPUT_FILE);
+		write_u64(out, place.line);
+		write_u64(out, place.column);
+	}
+}
+
+bool Dynamic_Cache::read_u64(const char *&p, const char *p_end, uint64_t &x)
+{
+	if ((size_t)(p_end - p) < sizeof(x))
+		return false;
+	memcpy(&x, p, sizeof(x));
+	p += sizeof(x);
+	return true;
+}
+
+bool Dynamic_Cache::read_string(const char *&p, const char *p_end, string &s)
+{
+	uint64_t size;
+	if (! read_u64(p, p_end, size) || (uint64_t)(p_end - p) < size)
+		return false;
+	s.assign(p, size);
+	p += size;
+	return true;
+}
+
+bool Dynamic_Cache::read_place(const char *&p, const char *p_end,
+			       const Place &place_file, Place &place)
+/* Line numbers are one-based, and therefore zero denotes an empty place */
+{
+	uint64_t line, column;
+	if (! read_u64(p, p_end, line))
+		return false;
+	if (line == 0) {
+		place= Place();
+		return true;
+	}
+	if (! read_u64(p, p_end, column))
+		return false;
+	place= Place(place_file, line, column);
+	return true;
+}
+
+#endif /* ! CACHE_HH */
@@ -50,13 +50,13 @@
 #include "flags.hh"
 
 template <typename T, typename U>
-shared_ptr <const T> to(shared_ptr <const U> d)
+shared_ptr <const T> to(const shared_ptr <const U> &d)
 {
 	return dynamic_pointer_cast <const T> (d); 
 }
 
 template <typename T, typename U>
-shared_ptr <const T> to(shared_ptr <U> d)
+shared_ptr <const T> to(const shared_ptr <U> &d)
 {
 	return dynamic_pointer_cast <const T> (d); 
 }
@@ -84,6 +84,15 @@ class Dep
  * argument of type shared_ptr<>.  [Note:  there is also
  * std::enable_shared_from_this as a possibility.]
  *
+ * Dep objects, and the shared_ptr<> objects that point to them, are
+ * only accessed by the main thread; the helper threads of the -S
+ * option only see filenames.  Functions therefore take their
+ * shared_ptr <const Dep> arguments by const reference, which avoids
+ * reference count updates, which are atomic once the helper threads
+ * exist.  Such a reference must not refer to an element of a
+ * container that the called function may modify; callers copy the
+ * pointer first, as in Execution::execute_children(). 
+ *
  * The constructors of Dep and derived classes do not set the TOP and
  * INDEX fields.  These are set manually when needed. 
  */ 
@@ -150,7 +159,7 @@ public:
 		places[i]= place; 
 	}
 
-	void add_flags(shared_ptr <const Dep> dep, 
+	void add_flags(const shared_ptr <const Dep> &dep, 
 		       bool overwrite_places);
 	/* Add the flags from DEP.  Also copy over the
 	 * corresponding places.  If a place is already given in THIS,
@@ -185,7 +194,7 @@ public:
 
 	virtual bool is_normalized() const= 0;
 
-	static void normalize(shared_ptr <const Dep> dep,
+	static void normalize(const shared_ptr <const Dep> &dep,
 			      vector <shared_ptr <const Dep> > &deps,
 			      int &error);
 	/* Split DEP into multiple DEPS that are each
@@ -196,10 +205,17 @@ public:
 	 * if not in keep-going mode, the function returns immediately. 
 	 */
 
-	static shared_ptr <Dep> clone(shared_ptr <const Dep> dep);
+	static shared_ptr <Dep> clone(const shared_ptr <const Dep> &dep);
 	/* A shallow clone */
 
-	static shared_ptr <const Dep> strip_dynamic(shared_ptr <const Dep> d);
+	static shared_ptr <Dep> clone_if_shared(shared_ptr <const Dep> &&dep);
+	/* Return DEP itself, made modifiable, if the caller holds the
+	 * only reference to it, i.e., when it was just created.
+	 * Otherwise, return a shallow clone.  Used when a modified
+	 * version of a dependency is needed, to avoid a copy when the
+	 * original is not used anymore.  */
+
+	static shared_ptr <const Dep> strip_dynamic(const shared_ptr <const Dep> &d);
 	/* Strip dynamic dependencies from the given dependency.
 	 * Perform recursively:  If D is a dynamic dependency, return
 	 * its contained dependency, otherwise return D.  Thus, never
@@ -340,7 +356,7 @@ public:
 	shared_ptr <const Dep> dep;
 	/* The contained dependency.  Non-null. */ 
 
-	Dynamic_Dep(shared_ptr <const Dep> dep_)
+	Dynamic_Dep(const shared_ptr <const Dep> &dep_)
 		/* Set the contained dependency.  NOT a copy constructor. */
 		:  Dep(F_TARGET_DYNAMIC),
 		   dep(dep_)
@@ -349,7 +365,7 @@ public:
 	}
 
 	Dynamic_Dep(Flags flags_,
-		    shared_ptr <const Dep> dep_)
+		    const shared_ptr <const Dep> &dep_)
 		:  Dep(flags_ | F_TARGET_DYNAMIC), 
 		   dep(dep_)
 	{
@@ -359,7 +375,7 @@ public:
 
 	Dynamic_Dep(Flags flags_,
 		    const Place places_[C_PLACED],
-		    shared_ptr <const Dep> dep_)
+		    const shared_ptr <const Dep> &dep_)
 		:  Dep(flags_ | F_TARGET_DYNAMIC, places_),
 		   dep(dep_)
 	{
@@ -431,7 +447,7 @@ public:
 	{  }
 
 	/* Append a dependency to the list */
-	void push_back(shared_ptr <const Dep> dep)
+	void push_back(const shared_ptr <const Dep> &dep)
 	{
 		deps.push_back(dep); 
 	}
@@ -451,19 +467,19 @@ public:
 
 	virtual Target get_target() const;
 
-	static shared_ptr <const Dep> concat(shared_ptr <const Dep> a,
-					     shared_ptr <const Dep> b,
+	static shared_ptr <const Dep> concat(const shared_ptr <const Dep> &a,
+					     const shared_ptr <const Dep> &b,
 					     int &error); 
 	/* Concatenate two dependencies to a single dependency.  On
 	 * error, a message is printed, bits are set in ERROR, and null
 	 * is returned.  Only plain and dynamic dependencies can be passed.  */
 
-	static shared_ptr <const Plain_Dep> concat_plain(shared_ptr <const Plain_Dep> a,
-							 shared_ptr <const Plain_Dep> b);
-	static shared_ptr <const Concat_Dep> concat_complex(shared_ptr <const Dep> a,
-							    shared_ptr <const Dep> b);
+	static shared_ptr <const Plain_Dep> concat_plain(const shared_ptr <const Plain_Dep> &a,
+							 const shared_ptr <const Plain_Dep> &b);
+	static shared_ptr <const Concat_Dep> concat_complex(const shared_ptr <const Dep> &a,
+							    const shared_ptr <const Dep> &b);
 
-	static void normalize_concat(shared_ptr <const Concat_Dep> dep,
+	static void normalize_concat(const shared_ptr <const Concat_Dep> &dep,
 				     vector <shared_ptr <const Dep> > &deps,
 				     int &error); 
 	/* Normalize this object's dependencies into a list of individual
@@ -474,7 +490,7 @@ public:
 	 * if not in keep-going mode, the function returns immediately. 
 	 */
 
-	static void normalize_concat(shared_ptr <const Concat_Dep> dep,
+	static void normalize_concat(const shared_ptr <const Concat_Dep> &dep,
 				     vector <shared_ptr <const Dep> > &deps,
 				     size_t start_index,
 				     int &error);
@@ -483,6 +499,33 @@ public:
 	 * On errors, a message is printed, bits are set in ERROR, and
 	 * if not in keep-going mode, the function returns immediately. 
 	 */
+
+	static bool split_concat(const shared_ptr <const Concat_Dep> &dep,
+				 vector <vector <shared_ptr <const Dep> > > &parts); 
+	/* Normalize each part of DEP separately into PARTS, such that
+	 * the normalized dependencies of DEP can be generated one by
+	 * one using get_product() instead of all at once using
+	 * normalize_concat().  Return FALSE if this is not possible,
+	 * i.e., when a part contains other than plain dependencies, or
+	 * when the concatenation is invalid.  In that case, PARTS is
+	 * unspecified and DEP must be normalized with normalize_concat(),
+	 * which also prints the errors.  Does not print any errors.  */
+
+	static shared_ptr <const Dep> get_product
+	(const shared_ptr <const Concat_Dep> &dep,
+	 const vector <vector <shared_ptr <const Dep> > > &parts,
+	 const vector <size_t> &indices);
+	/* The normalized dependency of DEP that concatenates the
+	 * elements of PARTS with the given INDICES.  Iterating over all
+	 * INDICES in lexicographic order gives the same dependencies in
+	 * the same order as normalize_concat().  PARTS must have been
+	 * generated by split_concat().  */
+
+	static shared_ptr <const Dep> finish_concat
+	(const shared_ptr <const Concat_Dep> &dep,
+	 shared_ptr <const Dep> &&d);
+	/* Complete the normalized dependency D of DEP:  canonicalize its
+	 * name and add the attributes of DEP.  */
 };
 
 class Compound_Dep
@@ -530,7 +573,7 @@ public:
 		   deps(deps_)
 	{  }
 
-	void push_back(shared_ptr <const Dep> dep)
+	void push_back(const shared_ptr <const Dep> &dep)
 	{
 		deps.push_back(dep); 
 	}
@@ -579,7 +622,7 @@ public:
 
 Dep::~Dep() { }
 
-void Dep::normalize(shared_ptr <const Dep> dep,
+void Dep::normalize(const shared_ptr <const Dep> &dep,
 		    vector <shared_ptr <const Dep> > &deps,
 		    int &error)
 {
@@ -619,7 +662,7 @@ void Dep::normalize(shared_ptr <const Dep> dep,
 	}
 }
 
-shared_ptr <Dep> Dep::clone(shared_ptr <const Dep> dep)
+shared_ptr <Dep> Dep::clone(const shared_ptr <const Dep> &dep)
 {
 	assert(dep); 
 
@@ -640,7 +683,18 @@ shared_ptr <Dep> Dep::clone(shared_ptr <const Dep> dep)
 	}
 }
 
-void Dep::add_flags(shared_ptr <const Dep> dep, 
+shared_ptr <Dep> Dep::clone_if_shared(shared_ptr <const Dep> &&dep)
+{
+	assert(dep); 
+	if (dep.use_count() == 1) {
+		/* All Dep objects are created non-const via
+		 * make_shared<>, so casting away the const is valid */ 
+		return const_pointer_cast <Dep> (dep); 
+	}
+	return clone(dep); 
+}
+
+void Dep::add_flags(const shared_ptr <const Dep> &dep, 
 		    bool overwrite_places)
 {
 	for (unsigned i= 0;  i < C_PLACED;  ++i) {
@@ -653,14 +707,15 @@ void Dep::add_flags(shared_ptr <const Dep> dep,
 	this->flags |= dep->flags; 
 }
 
-shared_ptr <const Dep> Dep::strip_dynamic(shared_ptr <const Dep> d)
+shared_ptr <const Dep> Dep::strip_dynamic(const shared_ptr <const Dep> &d)
 {
 	assert(d != nullptr); 
-	while (to <Dynamic_Dep> (d)) {
-		d= to <Dynamic_Dep> (d)->dep;
+	shared_ptr <const Dep> ret= d; 
+	while (to <Dynamic_Dep> (ret)) {
+		ret= to <Dynamic_Dep> (ret)->dep;
 	}
-	assert(d != nullptr); 
-	return d;
+	assert(ret != nullptr); 
+	return ret;
 }
 
 #ifndef NDEBUG
@@ -1023,7 +1078,7 @@ bool Concat_Dep::is_normalized() const
 	return true;
 }
 
-void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
+void Concat_Dep::normalize_concat(const shared_ptr <const Concat_Dep> &dep,
 				  vector <shared_ptr <const Dep> > &deps_,
 				  int &error) 
 {
@@ -1034,22 +1089,12 @@ void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
 	if (error && ! option_keep_going)
 		return;
 
-	/* Add attributes from DEP */ 	
-
-	if (dep->flags || dep->index >= 0 || dep->top) {
-		for (size_t k= k_init;  k < deps_.size();  ++k) {
-			shared_ptr <Dep> d_new= Dep::clone(deps_[k]); 
-			/* The innermost flag is kept */
-			d_new->add_flags(dep, false); 
-			if (dep->index >= 0)
-				d_new->index= dep->index;
-			d_new->top= dep->top; 
-			deps_[k]= d_new;
-		}
+	for (size_t k= k_init;  k < deps_.size();  ++k) {
+		deps_[k]= finish_concat(dep, move(deps_[k])); 
 	}
 }
 
-void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep, 
+void Concat_Dep::normalize_concat(const shared_ptr <const Concat_Dep> &dep, 
 				  vector <shared_ptr <const Dep> > &deps_,
 				  size_t start_index,
 				  int &error) 
@@ -1115,6 +1160,100 @@ void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
 	}
 }
 
+bool Concat_Dep::split_concat(const shared_ptr <const Concat_Dep> &dep,
+			      vector <vector <shared_ptr <const Dep> > > &parts)
+{
+	if (dep->deps.size() < 2)
+		return false; 
+
+	parts.resize(dep->deps.size()); 
+	for (size_t i= 0;  i < dep->deps.size();  ++i) {
+		const shared_ptr <const Dep> &dd= dep->deps[i]; 
+		/* Only plain dependencies and lists of them can be
+		 * normalized without errors.  As in normalize_concat(),
+		 * the flags of a list are not applied to its
+		 * elements.  */ 
+		int error= 0; 
+		if (auto compound_dd= to <Compound_Dep> (dd)) {
+			for (const auto &d:  compound_dd->deps) {
+				if (! to <Plain_Dep> (d))
+					return false;
+			}
+			for (const auto &d:  compound_dd->deps) 
+				normalize(d, parts[i], error); 
+		} else if (to <Plain_Dep> (dd)) {
+			normalize(dd, parts[i], error); 
+		} else {
+			return false; 
+		}
+		assert(error == 0); 
+
+		/* The same checks as in concat(), for the left and
+		 * right operand, respectively */
+		Flags flags_invalid= i == 0 
+			? F_INPUT | F_VARIABLE
+			: F_INPUT | F_PLACED | F_TARGET_TRANSIENT | F_VARIABLE; 
+		for (const auto &d:  parts[i]) {
+			assert(to <Plain_Dep> (d)); 
+			if (d->flags & flags_invalid)
+				return false; 
+		}
+	}
+
+	return true; 
+}
+
+shared_ptr <const Dep> Concat_Dep::get_product
+(const shared_ptr <const Concat_Dep> &dep,
+ const vector <vector <shared_ptr <const Dep> > > &parts,
+ const vector <size_t> &indices)
+{
+	assert(parts.size() >= 2); 
+	assert(indices.size() == parts.size()); 
+
+	/* Concatenate from the right, as in normalize_concat() */ 
+	int error= 0; 
+	size_t i= parts.size() - 1; 
+	shared_ptr <const Dep> ret= parts[i][indices[i]]; 
+	while (i--) {
+		ret= concat(parts[i][indices[i]], ret, error); 
+		assert(error == 0); 
+	}
+
+	return finish_concat(dep, move(ret)); 
+}
+
+shared_ptr <const Dep> Concat_Dep::finish_concat(const shared_ptr <const Concat_Dep> &dep,
+						 shared_ptr <const Dep> &&d)
+{
+	shared_ptr <const Plain_Dep> plain_d= to <Plain_Dep> (d); 
+	const bool canonicalize= plain_d != nullptr &&
+		! plain_d->place_param_target.place_name.is_parametrized(); 
+
+	if (! canonicalize && ! dep->flags && dep->index < 0 && ! dep->top)
+		return move(d); 
+
+	plain_d.reset(); 
+	shared_ptr <Dep> d_new= Dep::clone_if_shared(move(d)); 
+
+	/* The parts were only canonicalized individually */
+	if (canonicalize) {
+		dynamic_pointer_cast <Plain_Dep> (d_new)
+			->place_param_target.place_name.canonicalize(); 
+	}
+
+	/* Add attributes from DEP */
+	if (dep->flags || dep->index >= 0 || dep->top) {
+		/* The innermost flag is kept */
+		d_new->add_flags(dep, false); 
+		if (dep->index >= 0)
+			d_new->index= dep->index;
+		d_new->top= dep->top; 
+	}
+
+	return d_new; 
+}
+
 Target Concat_Dep::get_target() const
 {
 	/* Dep::get_target() is not used for complex dependencies */
@@ -1122,8 +1261,8 @@ Target Concat_Dep::get_target() const
 	return Target(""); 
 }
 
-shared_ptr <const Dep> Concat_Dep::concat(shared_ptr <const Dep> a,
-					  shared_ptr <const Dep> b,
+shared_ptr <const Dep> Concat_Dep::concat(const shared_ptr <const Dep> &a,
+					  const shared_ptr <const Dep> &b,
 					  int &error)
 {
 	assert(a);
@@ -1202,8 +1341,8 @@ shared_ptr <const Dep> Concat_Dep::concat(shared_ptr <const Dep> a,
 		return concat_complex(a, b); 
 }
 
-shared_ptr <const Plain_Dep> Concat_Dep::concat_plain(shared_ptr <const Plain_Dep> a,
-						      shared_ptr <const Plain_Dep> b)
+shared_ptr <const Plain_Dep> Concat_Dep::concat_plain(const shared_ptr <const Plain_Dep> &a,
+						      const shared_ptr <const Plain_Dep> &b)
 {
 	assert(a);
 	assert(b);
@@ -1236,8 +1375,8 @@ shared_ptr <const Plain_Dep> Concat_Dep::concat_plain(shared_ptr <const Plain_De
 	return ret; 
 }
 
-shared_ptr <const Concat_Dep> Concat_Dep::concat_complex(shared_ptr <const Dep> a,
-							 shared_ptr <const Dep> b)
+shared_ptr <const Concat_Dep> Concat_Dep::concat_complex(const shared_ptr <const Dep> &a,
+							 const shared_ptr <const Dep> &b)
 /* We don't have to make any checks here because any errors will be
  * caught later when the resulting plain dependencies are concatenated.
  * However, checking errors here is faster, since it avoids building
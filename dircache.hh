@@ -0,0 +1,157 @@
+#ifndef DIRCACHE_HH
+#define DIRCACHE_HH
+
+/*
+ * A cache of directory listings, used to avoid calling stat() on target
+ * files that do not exist.  In a clean build, the target of each rule
+ * is checked before its command is executed, and typically does not
+ * exist.  When several such files in the same directory have been found
+ * to be missing, the directory is read once, and further missing files
+ * in it are recognized from the listing, without calling stat().
+ *
+ * Only the absence of a file from a listing is used; files that are
+ * present in a listing are still checked with stat(), since their
+ * timestamp is needed.  A listing is updated when Stu creates the
+ * targets of a rule.  Files that are created by commands as a side
+ * effect, i.e., without being declared as targets, may therefore not be
+ * seen.  For this reason, the cache is only used with the -l option,
+ * and is only consulted for targets of rules that have a command, and
+ * which are not optional; a file that is wrongly considered missing
+ * will then have its command executed, as is the case when the file is
+ * older than one of its dependencies.  Nonexistent directories are
+ * cached as empty listings.
+ */
+
+#include <dirent.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+class Dir_Cache
+{
+public:
+	static bool missing(const char *filename);
+	/* Whether FILENAME is known not to exist from a cached listing.
+	 * When false is returned, the existence of the file is not
+	 * known, and stat() must be called.  */
+
+	static void miss(const char *filename);
+	/* Called when stat() found that FILENAME does not exist.  May
+	 * read the directory containing FILENAME.  Does nothing without
+	 * the -l option.  ERRNO is preserved.  */
+
+	static void created(const char *filename);
+	/* Called before Stu creates the file FILENAME */
+
+private:
+	struct Dir
+	{
+		unsigned misses;
+		/* Number of calls to miss() before the directory was
+		 * read */
+		bool listed;
+		/* Whether NAMES contains the listing of the directory */
+		unordered_set <string> names;
+	};
+
+	static const unsigned MISSES_MIN= 4;
+	/* Number of missing files in a directory before the directory
+	 * is read.  For smaller numbers, calling stat() is cheaper than
+	 * reading the directory.  */
+
+	static unordered_map <string, Dir> dirs;
+	/* By directory name, as in the filenames passed to the
+	 * functions, with "" for the current directory */
+
+	static bool split(const char *filename, string &dir, const char *&base);
+	/* Split FILENAME into a directory and a basename.  Return false
+	 * when the file cannot be looked up in a listing.  */
+
+	static void list(const string &dir_name, Dir &dir);
+};
+
+unordered_map <string, Dir_Cache::Dir> Dir_Cache::dirs;
+
+bool Dir_Cache::missing(const char *filename)
+{
+	if (dirs.empty())
+		return false;
+	string dir_name;
+	const char *base;
+	if (! split(filename, dir_name, base))
+		return false;
+	auto i= dirs.find(dir_name);
+	if (i == dirs.end() || ! i->second.listed)
+		return false;
+	return i->second.names.count(base) == 0;
+}
+
+void Dir_Cache::miss(const char *filename)
+{
+	if (! option_list_dirs)
+		return;
+	string dir_name;
+	const char *base;
+	if (! split(filename, dir_name, base))
+		return;
+	Dir &dir= dirs[dir_name];
+	if (dir.listed || ++dir.misses < MISSES_MIN)
+		return;
+	int errno_saved= errno;
+	list(dir_name, dir);
+	errno= errno_saved;
+}
+
+void Dir_Cache::created(const char *filename)
+{
+	if (dirs.empty())
+		return;
+	string dir_name;
+	const char *base;
+	if (! split(filename, dir_name, base))
+		return;
+	auto i= dirs.find(dir_name);
+	if (i == dirs.end() || ! i->second.listed)
+		return;
+	i->second.names.insert(base);
+}
+
+bool Dir_Cache::split(const char *filename, string &dir, const char *&base)
+{
+	const char *slash= strrchr(filename, '/');
+	if (slash == nullptr) {
+		dir= "";
+		base= filename;
+	} else {
+		dir= string(filename, slash - filename + 1);
+		base= slash + 1;
+	}
+	/* Entries such as "." and ".." do not name files in the
+	 * directory and are never looked up */
+	return *base != '\0'
+		&& strcmp(base, ".") != 0
+		&& strcmp(base, "..") != 0;
+}
+
+void Dir_Cache::list(const string &dir_name, Dir &dir)
+{
+	DIR *d= opendir(dir_name.empty() ? "." : dir_name.c_str());
+	if (d == nullptr) {
+		/* A nonexistent directory contains no files.  On other
+		 * errors, the directory is not cached. */
+		if (errno == ENOENT)
+			dir.listed= true;
+		return;
+	}
+	struct dirent *entry;
+	errno= 0;
+	while ((entry= readdir(d)) != nullptr)
+		dir.names.insert(entry->d_name);
+	if (errno == 0)
+		dir.listed= true;
+	else
+		dir.names.clear();
+	closedir(d);
+}
+
+#endif /* ! DIRCACHE_HH */
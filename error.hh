@@ -86,6 +86,8 @@
 
 #include <assert.h>
 
+#include <unordered_map>
+
 #include "options.hh"
 #include "text.hh"
 #include "color.hh"
@@ -177,6 +179,17 @@ void print_error_reminder(string message)
 		message.c_str()); 
 }
 
+void print_warning(string message)
+/* Print a warning without a place */
+{
+	assert(message != "");
+	assert(isupper(message[0]) || message[0] == '\''); 
+	assert(message[message.size() - 1] != '\n'); 
+	fprintf(stderr, "%s%s%s: warning: %s\n", 
+		Color::warning, dollar_zero, Color::end,
+		message.c_str()); 
+}
+
 string system_format(string text)
 /* System error message.  Includes the given message, and the
  * ERRNO-based text.  Cf. perror().  Color is not added.  The output of
@@ -234,11 +247,16 @@ class Place
  *
  * Places are used to show the location of an error on standard error
  * output.
+ *
+ * Place objects are contained in every token and dependency, and are
+ * copied often.  They are therefore kept small and trivially copyable:
+ * filenames are interned in a global table, and a Place only stores
+ * the index into that table.  
  */ 
 {
 public:
 
-	enum class Type {
+	enum class Type : unsigned char {
 		EMPTY,        /* Empty "Place" object */
 		INPUT_FILE,   /* In a file, with line/column numbers */
 		ARGUMENT,     /* Command line argument (outside options) */ 
@@ -246,20 +264,24 @@ public:
 		ENV_OPTIONS   /* In $STU_OPTIONS */
 	} type;
 
-	string text;
-	/* INPUT_FILE:  Name of the file in which the error occurred.
+private:
+	unsigned index_text;
+	/* Index of the text in the table returned by texts().  The text
+	 * is: 
+	 * INPUT_FILE:  Name of the file in which the error occurred.
 	 *              Empty string for standard input.  
 	 * OPTION:  Name of the option (a single character)
 	 * Others:  Unused  */ 
 
-	size_t line; 
+public:
+	unsigned line; 
 	/* INPUT_FILE:  Line number, one-based.  
 	 * Others:  unused.  
 	 * The line number is one-based, but is allowed to be set to
 	 * zero temporarily.  It should be >0 however when operator<<()
 	 * is called.  */ 
 
-	size_t column; 
+	unsigned column; 
 	/* INPUT_FILE:  Column number, zero-based.  In output, column
 	 * numbers are one-based, but they are saved here as zero-based
 	 * numbers as these are easier to generate. 
@@ -267,23 +289,39 @@ public:
 
 	Place() 
 	/* Empty */ 
-		:  type(Type::EMPTY) 
+		:  type(Type::EMPTY),
+		   index_text(0),
+		   line(0),
+		   column(0)
 	{  }
 
 	Place(Type type_,
-	      string filename_, 
-	      size_t line_, 
-	      size_t column_)
+	      const string &filename_, 
+	      unsigned line_, 
+	      unsigned column_)
 	/* Generic constructor */ 
 		:  type(type_),
-		   text(filename_),
+		   index_text(intern(filename_)),
+		   line(line_),
+		   column(column_)
+	{  }
+
+	Place(const Place &base,
+	      unsigned line_,
+	      unsigned column_)
+	/* In the same file as BASE, without looking up the filename */
+		:  type(base.type),
+		   index_text(base.index_text),
 		   line(line_),
 		   column(column_)
 	{  }
 
 	Place(Type type_)
 	/* In command line argument (ARGV) */ 
-		:  type(type_)
+		:  type(type_),
+		   index_text(0),
+		   line(0),
+		   column(0)
 	{
 		assert(type == Type::ARGUMENT); 
 	}
@@ -291,15 +329,21 @@ public:
 	Place(Type type_, char option)
 	/* In an option (OPTION) */
 		:  type(type_),
-		   text(string(&option, 1))
+		   index_text(intern(string(&option, 1))),
+		   line(0),
+		   column(0)
 	{ 
 		assert(type == Type::OPTION); 
 	}
-	
 
 	Type get_type() const { return type; }
 	const char *get_filename_str() const;
 
+	const string &get_text() const {
+		assert(index_text < texts().size()); 
+		return texts()[index_text]; 
+	}
+
 	const Place &operator<<(string message) const; 
 	/* Print the trace to STDERR as part of an error message.  The 
 	 * trace is printed as a single line, which can be parsed by
@@ -329,6 +373,14 @@ public:
 	/* A static empty place object, used in various places when a
 	 * reference to an empty place object is needed.  Otherwise,
 	 * Place() is an empty place.  */
+
+private:
+	static vector <string> &texts(); 
+	/* The interned texts.  Index 0 is the empty string.  Entries
+	 * are never removed.  */
+
+	static unsigned intern(const string &text);
+	/* The index of TEXT in texts(), adding it when necessary */ 
 };
 
 class Trace
@@ -382,7 +434,6 @@ void Place::print(string message,
 		  const char *color_word) const
 {
 	assert(message != "");
-	assert(line >= 1); 
 
 	switch (type) {
 	default:  
@@ -396,6 +447,7 @@ void Place::print(string message,
 		break; 
 
 	case Type::INPUT_FILE:
+		assert(line >= 1); 
 		fprintf(stderr,
 			"%s%s%s:%s%u%s:%s%u%s: %s\n", 
 			color_word, get_filename_str(), Color::end,
@@ -414,12 +466,12 @@ void Place::print(string message,
 		break;
 
 	case Type::OPTION:
-		assert(text.size() == 1); 
+		assert(get_text().size() == 1); 
 		fprintf(stderr,
 			"%sOption %s-%c%s: %s\n",
 			color,
 			color_word,
-			text[0],
+			get_text()[0],
 			Color::end,
 			message.c_str());
 		break;
@@ -443,7 +495,7 @@ string Place::as_argv0() const
 		return ""; 
 
 	case Type::OPTION:
-		return fmt("Option -%s", text); 
+		return fmt("Option -%s", get_text()); 
 
 	case Type::INPUT_FILE: {
 		/* The given argv[0] should not begin with a dash,
@@ -462,11 +514,34 @@ string Place::as_argv0() const
 const char *Place::get_filename_str() const
 {
 	assert(type == Type::INPUT_FILE);
+	const string &text= get_text(); 
 	return text == ""
 		? "<stdin>"
 		: text.c_str();
 }
 
+vector <string> &Place::texts()
+{
+	/* Local static to be independent of the order of initialization
+	 * of global objects */
+	static vector <string> ret(1); 
+	return ret; 
+}
+
+unsigned Place::intern(const string &text)
+{
+	if (text.empty())
+		return 0; 
+	static unordered_map <string, unsigned> indexes; 
+	auto i= indexes.find(text);
+	if (i != indexes.end())
+		return i->second;
+	unsigned index= texts().size();
+	texts().push_back(text); 
+	indexes[text]= index;
+	return index; 
+}
+
 void print_warning(const Place &place, string message)
 {
 	assert(message != "");
@@ -26,10 +26,18 @@
  * objects, i.e., F_RESULT_* flags.   
  */
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#if HAVE_SWAPCONTEXT
+#   include <ucontext.h>
+#endif
 
 #include "buffer.hh"
+#include "cache.hh"
+#include "dircache.hh"
+#include "journal.hh"
 #include "parser.hh"
+#include "prefetch.hh"
 #include "job.hh"
 #include "tokenizer.hh"
 #include "rule.hh"
@@ -59,6 +67,17 @@ enum {
 	 * nothing more should be done.  */
 };
 
+const size_t STACK_LOOP= sizeof(void *) >= 8 ? (size_t) 1 << 32 : (size_t) 1 << 28;
+/* Size of the stack reserved for executing the dependency graph, in
+ * bytes.  Only the used part is allocated.  A chain of 10^6
+ * dependencies uses less than 1 GB.  Deeper recursion hits the guard
+ * page at the end of the stack, i.e., it fails in the same way as on
+ * the native stack, but at a bounded size.  */
+
+const size_t STACK_LOOP_MIN= (size_t) 1 << 26; 
+/* The smallest size tried for that stack.  Below it, the separate
+ * stack does not gain much over the native one.  */
+
 class Execution
 /*
  * Base class of all executions.  At runtime, execution objects are used
@@ -107,6 +126,11 @@ public:
 		/* At least one file target is known not to exist (only
 		 * possible if there is at least one file target in
 		 * File_Execution).  */
+
+		B_STREAMED	= 1 << 4,
+		/* The file is a streamed input dependency (-s), and its
+		 * command is run by the job of the parent (only in
+		 * File_Execution).  */
 	};
 
 	void raise(int error_);
@@ -114,7 +138,7 @@ public:
 	 * error code, and throw an error except with the keep-going
 	 * option.  Does not print any error message.  */
 
-	Proceed execute_base_A(shared_ptr <const Dep> dep_link);
+	Proceed execute_base_A(const shared_ptr <const Dep> &dep_link);
 	/* DEPENDENCY_LINK must not be null.  In the return value, at
 	 * least one bit is set.  The P_FINISHED bit indicates only that
 	 * tasks related to this function are done, not the whole
@@ -122,9 +146,9 @@ public:
 
 	int get_error() const {  return error;  }
 
-	void read_dynamic(shared_ptr <const Plain_Dep> dep_target,
+	void read_dynamic(const shared_ptr <const Plain_Dep> &dep_target,
 			  vector <shared_ptr <const Dep> > &deps,
-			  shared_ptr <const Dep> dep,
+			  const shared_ptr <const Dep> &dep,
 			  Execution *dynamic_execution); 
 	/* Read dynamic dependencies from the content of
 	 * PLACE_PARAM_TARGET.  The only reason this is not static is
@@ -134,6 +158,25 @@ public:
 	 * whether the -n/-0/etc. flag was used, and may also contain
 	 * the -o flag to ignore a non-existing file.  */
 
+	void read_stream(Execution *dynamic_execution,
+			 bool complete,
+			 off_t &offset,
+			 size_t &line,
+			 vector <shared_ptr <const Dep> > &deps); 
+	/* Read the entries of the streamed dynamic dependency (-s) that
+	 * DYNAMIC_EXECUTION has on THIS, which is a
+	 * File_Execution, starting at byte OFFSET,
+	 * which is then advanced.  LINE is the number of entries
+	 * read before.  Unless COMPLETE is set, only entries that have been
+	 * completely written by the running job are read, and nothing
+	 * is read when the job is not running.  DEPS is empty when
+	 * called.  */
+
+	static void set_top_dynamic(vector <shared_ptr <const Dep> > &deps,
+				    const shared_ptr <const Plain_Dep> &dep_target); 
+	/* Set the top of the dependencies DEPS read from the dynamic
+	 * dependency DEP_TARGET.  Null entries in DEPS are removed.  */
+
 	void operator<<(string text) const;
 	/* Print full trace for the execution.  First the message is
 	 * Printed, then all traces for it starting at this execution,
@@ -144,7 +187,7 @@ public:
 	
 	virtual bool want_delete() const= 0; 
 
-	virtual Proceed execute(shared_ptr <const Dep> dep_this)= 0;
+	virtual Proceed execute(const shared_ptr <const Dep> &dep_this)= 0;
 	/* Start the next job(s).  This will also terminate jobs when
 	 * they don't need to be run anymore, and thus it can be called
 	 * when K = 0 just to terminate jobs that need to be terminated.
@@ -171,10 +214,10 @@ public:
 
 	virtual string format_src() const= 0;
 
-	virtual void notify_result(shared_ptr <const Dep> dep,
+	virtual void notify_result(const shared_ptr <const Dep> &dep,
 				   Execution *source,
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source)
+				   const shared_ptr <const Dep> &dep_source)
 	/* The child execution SOURCE notifies THIS about a new result.
 	 * Only called when the dependency linking the two had one of the
 	 * F_RESULT_* flag.  The given flag contains only one of the two
@@ -189,10 +232,18 @@ public:
 		assert(false);
 	}
 
-	virtual void notify_variable(const map <string, string> &result_variable_child) {  
+	virtual void notify_variable(const Variables &result_variable_child) {  
 		(void) result_variable_child; 
 	}
 
+	virtual void compact(); 
+	/* Called on a completely finished execution that is not deleted.
+	 * Free all data that is only needed while the execution is
+	 * active, keeping only what is needed to answer later requests
+	 * from new parents, i.e., the timestamp, the error, the bits,
+	 * the result and the information about what was done.  May be
+	 * called multiple times.  */
+
 	static long jobs;
 	/* Number of free slots for jobs.  This is a long because
 	 * strtol() gives a long.  Set before calling main() from the -j
@@ -207,9 +258,25 @@ public:
 	/* Main execution loop.  This throws ERROR_BUILD and
 	 * ERROR_LOGICAL.  */
 
-	static Target get_target_for_cache(Target target); 
-	/* Get the target value used for caching.  I.e, return TARGET
-	 * with certain flags removed.  */
+	static void main_loop(Execution *root_execution,
+			      const shared_ptr <const Dep> &dep_root);
+	/* Execute the root execution until it is finished.  Throws
+	 * errors like main().  */
+
+	static void main_loop_stack(Execution *root_execution,
+				    const shared_ptr <const Dep> &dep_root);
+	/* Call main_loop() on a separate stack of size STACK_LOOP.
+	 * Executions call each other recursively along the dependency
+	 * graph, and the native stack would overflow for long chains of
+	 * dependencies.  The stack is reserved but only allocated as it
+	 * is used.  When that much cannot be reserved, smaller sizes
+	 * down to STACK_LOOP_MIN are tried.  If that fails too, a
+	 * warning is printed and the native stack is used.  Without
+	 * swapcontext(), the native stack is always used.  */
+
+	static void get_target_for_cache(Target &target); 
+	/* Turn TARGET into the target value used for caching, i.e.,
+	 * remove certain flags.  */
 
 protected: 
 
@@ -251,7 +318,7 @@ protected:
 	 * dependencies, parents are notified directly, bypassing
 	 * push_result().  */ 
 
-	map <string, string> result_variable; 
+	Variables result_variable; 
 	/* Same semantics as RESULT, but for variable values, stored as
 	 * KEY-VALUE pairs.  */
 
@@ -266,13 +333,22 @@ protected:
 		:  bits(0),
 		   error(0),
 		   timestamp(Timestamp::UNDEFINED),
-		   param_rule(param_rule_)
-	{  }
+		   param_rule(param_rule_),
+		   cycle_search(0)
+	{
+		count_param_rule(); 
+	}
+
+	void count_param_rule() {
+		if (param_rule != nullptr)
+			++counts_param_rule[param_rule.get()]; 
+	}
+	/* Called once PARAM_RULE is set */ 
 
 	Proceed execute_children();
 	/* Execute already-active children */
 
-	Proceed execute_base_B(shared_ptr <const Dep> dep_link); 
+	Proceed execute_base_B(const shared_ptr <const Dep> &dep_link); 
 	/* Second pass (trivial dependencies).  Called once we are sure
 	 * that the target must be built.  Arguments and return value
 	 * have the same semantics as execute_base_B().  */
@@ -286,14 +362,14 @@ protected:
 	const Buffer &get_buffer_A() const {  return buffer_A;  }
 	const Buffer &get_buffer_B() const {  return buffer_B;  }
 
-	void push(shared_ptr <const Dep> dep);
+	void push(const shared_ptr <const Dep> &dep);
 	/* Push a dependency to the default buffer, breaking down
 	 * non-normalized dependencies while doing so.  DEP does not
 	 * have to be normalized.  */
 
-	void push_result(shared_ptr <const Dep> dd); 
+	void push_result(const shared_ptr <const Dep> &dd); 
 	void disconnect(Execution *const child,
-			shared_ptr <const Dep> dep_child);
+			const shared_ptr <const Dep> &dep_child);
 	/* Remove an edge from the dependency graph.  Propagate
 	 * information from CHILD to THIS, and then delete CHILD if
 	 * necessary.  */
@@ -315,7 +391,7 @@ protected:
 	 * is always null.  Only used to check for cycles on the rule
 	 * level.  */ 
 
-	virtual bool optional_finished(shared_ptr <const Dep> dep_link)= 0;
+	virtual bool optional_finished(const shared_ptr <const Dep> &dep_link)= 0;
 	/* Whether the execution would be finished if this was an
 	 * optional dependency.  Check whether this is an optional
 	 * dependency and if it is, return TRUE when the file does not
@@ -334,27 +410,41 @@ protected:
 
 	static unordered_map <Target, Execution *> executions_by_target;
 	/* All cached Execution objects by each of their Target.  Such
-	 * Execution objects are never deleted.  */
+	 * Execution objects are never deleted, but are compacted once
+	 * they are finished.  */
+
+	static Execution *get_execution_by_target(const Target &target); 
+	/* The cached Execution object of TARGET, or null if there is
+	 * none.  TARGET must be a target as used for caching.  */
 
 	static bool find_cycle(Execution *parent,
 			       Execution *child,
-			       shared_ptr <const Dep> dep_link);
+			       const shared_ptr <const Dep> &dep_link);
 	/* Find a cycle.  Assuming that the edge parent->child will be
 	 * added, find a directed cycle that would be created.  Start at
 	 * PARENT and perform a depth-first search upwards in the
 	 * hierarchy to find CHILD.  DEPENDENCY_LINK is the link that
 	 * would be added between child and parent, and would create a
-	 * cycle.  */
+	 * cycle.  Each execution is visited at most once, such that
+	 * the search is linear in the number of ancestors of PARENT.  */
 
 	static bool find_cycle(vector <Execution *> &path,
 			       Execution *child,
-			       shared_ptr <const Dep> dep_link); 
+			       const shared_ptr <const Dep> &dep_link); 
 	/* Helper function.  PATH is the currently explored path.
 	 * PATH[0] is the original PARENT; PATH[end] is the oldest
 	 * grandparent found yet.  */ 
 
+	static unsigned long cycle_searches;
+	/* Number of calls to find_cycle() that performed a search */ 
+
+	static unordered_map <const Rule *, size_t> counts_param_rule;
+	/* The number of executions created for each parametrized rule.
+	 * Not decremented when executions are deleted, and therefore
+	 * an upper bound.  Used to avoid searching for cycles.  */ 
+
 	static void cycle_print(const vector <Execution *> &path,
-				shared_ptr <const Dep> dep);
+				const shared_ptr <const Dep> &dep);
 	/* Print the error message of a cycle on rule level.
 	 * Given PATH = [a, b, c, d, ..., x], the found cycle is
 	 * [x <- a <- b <- c <- d <- ... <- x], where A <- B denotes
@@ -368,10 +458,10 @@ protected:
 	/* Whether both executions have the same parametrized rule.
 	 * Only used for finding cycle.  */ 
 
-	shared_ptr <const Dep> append_top(shared_ptr <const Dep> dep, 
-					  shared_ptr <const Dep> top); 
-	shared_ptr <const Dep> set_top(shared_ptr <const Dep> dep,
-				       shared_ptr <const Dep> top); 
+	shared_ptr <const Dep> append_top(const shared_ptr <const Dep> &dep, 
+					  const shared_ptr <const Dep> &top); 
+	shared_ptr <const Dep> set_top(const shared_ptr <const Dep> &dep,
+				       const shared_ptr <const Dep> &top); 
 
 private: 
 
@@ -389,12 +479,16 @@ private:
 	 * dependencies, the target must be rebuilt anyway.  Does not
 	 * contain compound dependencies.  */
 
-	Proceed connect(shared_ptr <const Dep> dep_this,
-			shared_ptr <const Dep> dep_child);
+	unsigned long cycle_search;
+	/* The value of CYCLE_SEARCHES when this execution was last
+	 * visited by find_cycle() */
+
+	Proceed connect(const shared_ptr <const Dep> &dep_this,
+			const shared_ptr <const Dep> &dep_child);
 	/* Add an edge to the dependency graph.  Deploy a new child
 	 * execution.  DEP_CHILD must be normalized.  */
 
-	Execution *get_execution(shared_ptr <const Dep> dep);
+	Execution *get_execution(const shared_ptr <const Dep> &dep);
 	/* Get an existing Execution or create a new one for the
 	 * given DEPENDENCY.  Return null when a strong cycle was found;
 	 * return the execution otherwise.  PLACE is the place of where
@@ -406,8 +500,8 @@ private:
 	static bool hide_link_from_message(Flags flags) {
 		return flags & F_RESULT_NOTIFY; 
 	}
-	static bool same_dependency_for_print(shared_ptr <const Dep> d1,
-					      shared_ptr <const Dep> d2)
+	static bool same_dependency_for_print(const shared_ptr <const Dep> &d1,
+					      const shared_ptr <const Dep> &d2)
 	{
 		shared_ptr <const Plain_Dep> p1=
 			to <Plain_Dep> (d1); 
@@ -447,10 +541,10 @@ class File_Execution
 {
 public:
 
-	File_Execution(shared_ptr <const Dep> dep_link,
+	File_Execution(const shared_ptr <const Dep> &dep_link,
 		       Execution *parent,
-		       shared_ptr <const Rule> rule,
-		       shared_ptr <const Rule> param_rule,
+		       const shared_ptr <const Rule> &rule,
+		       const shared_ptr <const Rule> &param_rule,
 		       map <string, string> &mapping_parameter_,
 		       int &error_additional);
 	/* ERROR_ADDITIONAL indicates whether an error will be thrown
@@ -459,7 +553,7 @@ public:
 	 * done in the constructor.  The parent is connected to this iff
 	 * ERROR_ADDITIONAL is zero after the call.  */
 
-	void read_variable(shared_ptr <const Dep> dep); 
+	void read_variable(const shared_ptr <const Dep> &dep); 
 	/* Read the content of the file into a string as the
 	 * variable value.  THIS is the variable execution.  Write the
 	 * result into THIS's RESULT_VARIABLE.  */
@@ -471,16 +565,17 @@ public:
 	}
 
 	virtual bool want_delete() const {  return false;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(const shared_ptr <const Dep> &dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual string format_src() const {
 		assert(targets.size()); 
 		return targets.front().format_src(); 
 	}
-	virtual void notify_variable(const map <string, string> &result_variable_child) {  
+	virtual void notify_variable(const Variables &result_variable_child) {  
 		mapping_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
+	virtual void compact(); 
 
 	static size_t executions_by_pid_size;
 	static pid_t *executions_by_pid_key;
@@ -505,7 +600,7 @@ public:
 
 protected:
 
-	virtual bool optional_finished(shared_ptr <const Dep> dep_link);
+	virtual bool optional_finished(const shared_ptr <const Dep> &dep_link);
 	virtual int get_depth() const {  return 0;  }
 
 private:
@@ -560,7 +655,7 @@ private:
 	map <string, string> mapping_parameter; 
 	/* Variable assignments from parameters for when the command is run */
 
-	map <string, string> mapping_variable; 
+	Variables mapping_variable; 
 	/* Variable assignments from variables dependencies */
 
 	Done done; 
@@ -600,7 +695,14 @@ private:
 	 * Is currently running.  */ 
 
 	void write_content(const char *filename, const Command &command); 
-	/* Create the file FILENAME with content from COMMAND */
+	/* Create the file FILENAME with content from COMMAND.  An
+	 * existing file with the same content is not rewritten.  */
+
+	static bool is_content_unchanged(const char *filename, off_t size,
+					 const Command &command); 
+	/* Whether the existing file FILENAME of size SIZE has exactly
+	 * the content from COMMAND.  Errors are ignored and give
+	 * FALSE.  */
 
 	static unordered_map <string, Timestamp> transients;
 	/* The timestamps for transient targets.  This container plays
@@ -622,32 +724,33 @@ class Transient_Execution
 {
 public:
 
-	Transient_Execution(shared_ptr <const Dep> dep_link,
+	Transient_Execution(const shared_ptr <const Dep> &dep_link,
 			    Execution *parent,
-			    shared_ptr <const Rule> rule,
-			    shared_ptr <const Rule> param_rule,
+			    const shared_ptr <const Rule> &rule,
+			    const shared_ptr <const Rule> &param_rule,
 			    map <string, string> &mapping_parameter,
 			    int &error_additional);
 
 	shared_ptr <const Rule> get_rule() const { return rule; }
 
 	virtual bool want_delete() const {  return false;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(const shared_ptr <const Dep> &dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual string format_src() const;
-	virtual void notify_result(shared_ptr <const Dep> dep, 
+	virtual void notify_result(const shared_ptr <const Dep> &dep, 
 				   Execution *, 
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source);
-	virtual void notify_variable(const map <string, string> &result_variable_child) {  
+				   const shared_ptr <const Dep> &dep_source);
+	virtual void notify_variable(const Variables &result_variable_child) {  
 		result_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
+	virtual void compact(); 
 
 protected:
 
 	virtual int get_depth() const {  return 0;  }
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(const shared_ptr <const Dep> &) {  return false;  }
 
 private:
 
@@ -656,7 +759,8 @@ private:
 	 * are transients.  Contains at least one element.  */
 
 	shared_ptr <const Rule> rule;
-	/* The instantiated file rule for this execution.  Never null. */ 
+	/* The instantiated file rule for this execution.  Never null,
+	 * except after compact().  */ 
 
 	Timestamp timestamp_old;
 
@@ -665,7 +769,7 @@ private:
 	map <string, string> mapping_parameter; 
 	/* Contains the parameters; is not used */
 
-	map <string, string> mapping_variable; 
+	Variables mapping_variable; 
 	/* Variable assignments from variables dependencies.  This is in
 	 * Transient_Execution because it may be percolated up to the
 	 * parent execution.  */
@@ -681,7 +785,7 @@ public:
 	Root_Execution(const vector <shared_ptr <const Dep> > &dep); 
 
 	virtual bool want_delete() const {  return true;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(const shared_ptr <const Dep> &dep_this);
 	virtual bool finished() const; 
 	virtual bool finished(Flags flags) const;
 	virtual string format_src() const { return "ROOT"; }
@@ -689,7 +793,7 @@ public:
 protected:
 
 	virtual int get_depth() const {  return -1;  }
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(const shared_ptr <const Dep> &) {  return false;  }
 
 private:
 
@@ -713,7 +817,7 @@ class Concat_Execution
 {
 public:
 
-	Concat_Execution(shared_ptr <const Concat_Dep> dep_,
+	Concat_Execution(const shared_ptr <const Concat_Dep> &dep_,
 			 Execution *parent,
 			 int &error_additional); 
 	/* DEP_ is normalized.  See File_Execution::File_Execution() for
@@ -723,21 +827,21 @@ public:
 
 	virtual int get_depth() const {  return -1;  }
 	virtual bool want_delete() const {  return true;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(const shared_ptr <const Dep> &dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual string format_src() const {  return dep->format_src();  }
 
-	virtual void notify_variable(const map <string, string> &result_variable_child) {  
+	virtual void notify_variable(const Variables &result_variable_child) {  
 		result_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
-	virtual void notify_result(shared_ptr <const Dep> dep, 
+	virtual void notify_result(const shared_ptr <const Dep> &dep, 
 				   Execution *source, 
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source);
+				   const shared_ptr <const Dep> &dep_source);
 protected:
 
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(const shared_ptr <const Dep> &) {  return false;  }
 
 private:
 
@@ -776,26 +880,34 @@ class Dynamic_Execution
 {
 public:
 
-	Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
+	Dynamic_Execution(const shared_ptr <const Dynamic_Dep> &dep_,
 			  Execution *parent,
 			  int &error_additional); 
 
 	shared_ptr <const Dynamic_Dep> get_dep() const {  return dep;  }
 
 	virtual bool want_delete() const;
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(const shared_ptr <const Dep> &dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual int get_depth() const {  return dep->get_depth();  }
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(const shared_ptr <const Dep> &) {  return false;  }
 	virtual string format_src() const;
-	virtual void notify_variable(const map <string, string> &result_variable_child) {  
+	virtual void notify_variable(const Variables &result_variable_child) {  
 		result_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
-	virtual void notify_result(shared_ptr <const Dep> dep, 
+	virtual void notify_result(const shared_ptr <const Dep> &dep, 
 				   Execution *source, 
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source);
+				   const shared_ptr <const Dep> &dep_source);
+
+	static size_t count_streaming;
+	/* Number of streamed dynamic dependencies (-s) whose file may
+	 * still be written.  While not zero, the main loop wakes up
+	 * regularly to read them.  */
+
+	static const int STREAM_INTERVAL_MS= 100;
+	/* Interval at which streamed dynamic dependencies are read */
 
 private: 
 
@@ -803,6 +915,18 @@ private:
 	/* A dynamic of anything */
 
 	bool is_finished; 
+
+	bool is_streaming;
+	/* The dynamic dependency is streamed (-s), and its file has not
+	 * been read completely yet */
+
+	off_t offset_stream;
+	size_t line_stream; 
+	/* The number of bytes and entries of the streamed file that
+	 * were already read */
+
+	void push_dynamic(vector <shared_ptr <const Dep> > &deps); 
+	/* Push dependencies read from the dynamic dependency */
 };
 
 class Debug
@@ -847,8 +971,11 @@ Timestamp Execution::timestamp_last;
 bool Execution::hide_out_message= false;
 bool Execution::out_message_done= false;
 unordered_map <Target, Execution *> Execution::executions_by_target;
+unsigned long Execution::cycle_searches= 0;
+unordered_map <const Rule *, size_t> Execution::counts_param_rule;
 
 size_t File_Execution::executions_by_pid_size= 0;
+size_t Dynamic_Execution::count_streaming= 0;
 pid_t *File_Execution::executions_by_pid_key= nullptr;
 File_Execution **File_Execution::executions_by_pid_value= nullptr; 
 unordered_map <string, Timestamp> File_Execution::transients;
@@ -870,18 +997,7 @@ void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 	shared_ptr <const Root_Dep> dep_root= make_shared <Root_Dep> (); 
 
 	try {
-		while (! root_execution->finished()) {
-			Proceed proceed;
-			do {
-				Debug::print(nullptr, "loop"); 
-				proceed= root_execution->execute(dep_root);
-				assert(proceed); 
-			} while (proceed & P_PENDING); 
-
-			if (proceed & P_WAIT) {
-				File_Execution::wait();
-			}
-		}
+		main_loop_stack(root_execution, dep_root); 
 
 		assert(root_execution->finished()); 
 		assert(File_Execution::executions_by_pid_size == 0); 
@@ -924,9 +1040,109 @@ void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 		throw error; 
 }
 
-void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
+void Execution::main_loop(Execution *root_execution,
+			  const shared_ptr <const Dep> &dep_root)
+{
+	while (! root_execution->finished()) {
+		Proceed proceed;
+		do {
+			Debug::print(nullptr, "loop"); 
+			proceed= root_execution->execute(dep_root);
+			assert(proceed); 
+		} while (proceed & P_PENDING); 
+
+		if (proceed & P_WAIT) {
+			File_Execution::wait();
+		}
+	}
+}
+
+#if HAVE_SWAPCONTEXT
+
+/* Passed between main_loop_stack() and the function running on the
+ * separate stack */
+static Execution *loop_root_execution;
+static const shared_ptr <const Dep> *loop_dep_root;
+static int loop_error;
+static sigset_t loop_sigmask; 
+static ucontext_t loop_context_main, loop_context;
+
+static void loop_entry()
+{
+	try {
+		Execution::main_loop(loop_root_execution, *loop_dep_root); 
+	} catch (int e) {
+		assert(e); 
+		loop_error= e; 
+	}
+	/* The signal mask is restored when switching contexts */ 
+	sigprocmask(SIG_SETMASK, nullptr, &loop_sigmask); 
+}
+
+void Execution::main_loop_stack(Execution *root_execution,
+				const shared_ptr <const Dep> &dep_root)
+{
+	const size_t size_page= sysconf(_SC_PAGESIZE); 
+
+	/* With strict overcommit accounting or with a limit on the size
+	 * of the address space (ulimit -v), MAP_NORESERVE has no effect
+	 * and a large reservation fails */ 
+	size_t size= STACK_LOOP; 
+	void *stack;
+	while (MAP_FAILED == 
+	       (stack= mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0))) {
+		if (size / 2 < STACK_LOOP_MIN) {
+			print_warning(fmt("Using the native stack, because a separate "
+					  "stack could not be reserved: %s", 
+					  strerror(errno))); 
+			main_loop(root_execution, dep_root); 
+			return; 
+		}
+		size /= 2; 
+	}
+	/* Guard page, since the stack grows downwards on all
+	 * supported platforms */ 
+	if (mprotect(stack, size_page, PROT_NONE) < 0) {
+		perror("mprotect");
+		abort(); 
+	}
+
+	loop_root_execution= root_execution;
+	loop_dep_root= &dep_root;
+	loop_error= 0; 
+	if (getcontext(&loop_context) < 0) {
+		perror("getcontext");
+		abort(); 
+	}
+	loop_context.uc_stack.ss_sp= stack;
+	loop_context.uc_stack.ss_size= size; 
+	loop_context.uc_link= &loop_context_main; 
+	makecontext(&loop_context, loop_entry, 0); 
+	if (swapcontext(&loop_context_main, &loop_context) < 0) {
+		perror("swapcontext");
+		abort(); 
+	}
+	sigprocmask(SIG_SETMASK, &loop_sigmask, nullptr); 
+	munmap(stack, size); 
+
+	if (loop_error)
+		throw loop_error; 
+}
+
+#else /* ! HAVE_SWAPCONTEXT */
+
+void Execution::main_loop_stack(Execution *root_execution,
+				const shared_ptr <const Dep> &dep_root)
+{
+	main_loop(root_execution, dep_root); 
+}
+
+#endif /* ! HAVE_SWAPCONTEXT */
+
+void Execution::read_dynamic(const shared_ptr <const Plain_Dep> &dep_target,
 			     vector <shared_ptr <const Dep> > &deps,
-			     shared_ptr <const Dep> dep,
+			     const shared_ptr <const Dep> &dep,
 			     Execution *dynamic_execution)
 {
 	try {
@@ -953,10 +1169,22 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 		assert(target.is_file()); 
 		string filename= target.get_name_nondynamic();
 
-		bool delim= (dep_target->flags & (F_NEWLINE_SEPARATED | F_NUL_SEPARATED));
-		/* Whether the dynamic dependency is delimiter-separated */
+		bool delim= (dep_target->flags & F_ATTRIBUTE);
+		/* Whether the dynamic dependency is delimiter-separated or
+		 * in Make syntax, i.e., not in Stu syntax */
 
-		if (! delim) {
+		struct stat buf;
+		bool cache= Dynamic_Cache::enabled() && stat(filename.c_str(), &buf) == 0;
+		/* Whether the cache of dynamic dependencies (-D) is used.
+		 * When the file cannot be stat()ed, the parser reports
+		 * the error.  */
+		bool cache_hit= false, cache_put= cache;
+
+		if (cache && Dynamic_Cache::get(filename, dep_target->flags & F_ATTRIBUTE, 
+						&buf, deps)) {
+			cache_hit= true;
+			cache_put= false; 
+		} else if (! delim) {
 
 			/* Dynamic dependency in full Stu syntax */ 
 
@@ -981,6 +1209,7 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 							    place_end, input, place_input);
 			} catch (int e) {
 				raise(e); 
+				cache_put= false;
 				goto end_normal;
 			}
 
@@ -996,22 +1225,21 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 				(*dynamic_execution) << fmt("%s is declared here",
 							    target_file.format_word()); 
 				raise(ERROR_LOGICAL);
+				cache_put= false; 
 			}
 		end_normal:;
 
 		} else {
-			/* Delimiter-separated dynamic dependency (-n/-0) */
-
-			const char c= (dep_target->flags & F_NEWLINE_SEPARATED) ? '\n' : '\0';
-			/* The delimiter */ 
-
-			const char c_printed= (dep_target->flags & F_NEWLINE_SEPARATED) ? 'n' : '0';
-			/* The character to print as the delimiter in output */
+			/* Delimiter-separated dynamic dependency (-n/-0),
+			 * or dependency file in Make syntax (-d) */
 
 			try {
-				Parser::get_expression_list_delim(deps, filename.c_str(), c, c_printed, *dynamic_execution);
+				Parser::get_expression_list_file(deps, filename.c_str(), 
+								 dep_target->flags, 
+								 *dynamic_execution);
 			} catch (int e) {
 				raise(e);
+				cache_put= false; 
 			}
 		}
 
@@ -1019,7 +1247,7 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 		 * In keep-going mode (-k), we set the error, set the erroneous
 		 * dependency to null, and at the end prune the null entries.  */
 		bool found_error= false; 
-		if (! delim)  for (auto &j:  deps) {
+		if (! delim && ! cache_hit)  for (auto &j:  deps) {
 			/* Check that it is unparametrized */ 
 			if (! j->is_unparametrized()) {
 				shared_ptr <const Dep> depp= j;
@@ -1045,31 +1273,173 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 		}
 
 		assert(! found_error || option_keep_going); 
-		vector <shared_ptr <const Dep> > deps_new;
+		if (cache_put && ! found_error)
+			Dynamic_Cache::put(filename, dep_target->flags & F_ATTRIBUTE, 
+					   &buf, deps); 
 
-		shared_ptr <const Dep> top_top= dep_target->top;
-		shared_ptr <Dep> no_top= Dep::clone(dep_target);
-		no_top->top= nullptr; 
-		shared_ptr <Dep> top= make_shared <Dynamic_Dep> (no_top); 
-		top->top= top_top;
+		set_top_dynamic(deps, dep_target); 
+	} catch (int e) {
+		dynamic_execution->raise(e); 
+	}
+}
+
+void Execution::set_top_dynamic(vector <shared_ptr <const Dep> > &deps,
+				const shared_ptr <const Plain_Dep> &dep_target)
+{
+	vector <shared_ptr <const Dep> > deps_new;
+
+	shared_ptr <const Dep> top_top= dep_target->top;
+	shared_ptr <Dep> no_top= Dep::clone(dep_target);
+	no_top->top= nullptr; 
+	shared_ptr <Dep> top= make_shared <Dynamic_Dep> (no_top); 
+	top->top= top_top;
 		
-		for (auto &j:  deps) {
-			if (j) {
-				shared_ptr <Dep> j_new= Dep::clone(j);
-				j_new->top= top; 
-				deps_new.push_back(j_new); 
+	/* Dependencies from the parser are not shared and are
+	 * modified in place; those from the cache are cloned */
+	for (auto &j:  deps) {
+		if (j) {
+			shared_ptr <Dep> j_new= Dep::clone_if_shared(move(j));
+			j_new->top= top; 
+			deps_new.push_back(move(j_new)); 
+		}
+	}
+	swap(deps, deps_new); 
+}
+
+void Execution::read_stream(Execution *dynamic_execution,
+			    bool complete,
+			    off_t &offset,
+			    size_t &line,
+			    vector <shared_ptr <const Dep> > &deps)
+/* The file is read with pread(), because it may be appended to while
+ * it is read.  */
+{
+	assert(deps.empty()); 
+	File_Execution *const file_execution= dynamic_cast <File_Execution *> (this); 
+	assert(file_execution); 
+
+	shared_ptr <Dep> dep_target= Dep::clone(parents.at(dynamic_execution));
+	dep_target->flags &= ~F_RESULT_NOTIFY; 
+	const Place_Param_Target &place_param_target= 
+		to <Plain_Dep> (dep_target)->place_param_target; 
+	const string filename= place_param_target.place_name.unparametrized(); 
+	const char c= (dep_target->flags & F_NUL_SEPARATED) ? '\0' : '\n'; 
+	string in;
+	size_t size= 0; 
+	struct stat buf;
+	int fd;
+
+	if (! complete && ! file_execution->job.started())
+		return;
+
+	fd= open(filename.c_str(), O_RDONLY); 
+	if (fd < 0) {
+		/* The job may not have created the file yet */ 
+		if (! complete && errno == ENOENT)
+			return;
+		goto error;
+	}
+
+	if (0 > fstat(fd, &buf))
+		goto error_close; 
+
+	if (! complete) {
+		if (! S_ISREG(buf.st_mode)) {
+			close(fd);
+			return;
+		}
+		/* Don't read the file as it was before the job was
+		 * started */
+		const vector <Target> &targets= file_execution->targets; 
+		const Timestamp *timestamps_old= file_execution->timestamps_old; 
+		for (size_t i= 0;  i < targets.size();  ++i) {
+			if (targets[i].is_file() && 
+			    targets[i].get_name_nondynamic() == filename &&
+			    timestamps_old[i].defined() && 
+			    ! (timestamps_old[i] < Timestamp(&buf))) {
+				close(fd);
+				return;
 			}
 		}
-		swap(deps, deps_new); 
+	}
+
+	if (buf.st_size < offset) {
+		close(fd); 
+		place_param_target.place <<
+			fmt("file %s must not be truncated while it is read as streamed dynamic dependency",
+			    name_format_word(filename)); 
+		*dynamic_execution << "";
+		dynamic_execution->raise(ERROR_BUILD);
+		return;
+	}
+
+	in.resize(buf.st_size - offset); 
+	while (size < in.size()) {
+		ssize_t r= pread(fd, &in[size], in.size() - size, offset + size); 
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			goto error_close; 
+		}
+		if (r == 0)
+			break;
+		size += r; 
+	}
+
+	if (0 > close(fd))
+		goto error; 
+
+	/* Leave out the entry that is being written */ 
+	if (! complete) {
+		while (size > 0 && in[size - 1] != c)
+			--size; 
+	}
+	if (size == 0)
+		return;
+
+	try {
+		Parser::get_expression_list_delim(deps, filename.c_str(), in.data(), size, 
+						  c, c == '\0' ? '0' : 'n', 
+						  *dynamic_execution, line); 
 	} catch (int e) {
+		deps.clear(); 
 		dynamic_execution->raise(e); 
+		return;
 	}
+
+	offset += size;
+	line += deps.size(); 
+	set_top_dynamic(deps, to <Plain_Dep> (dep_target)); 
+	return;
+
+ error_close:
+	{
+		int errno_save= errno;
+		close(fd); 
+		errno= errno_save; 
+	}
+ error:
+	print_error_system(filename); 
+	dynamic_execution->raise(ERROR_BUILD); 
 }
 
 bool Execution::find_cycle(Execution *parent, 
 			   Execution *child,
-			   shared_ptr <const Dep> dep_link)
+			   const shared_ptr <const Dep> &dep_link)
 {
+	/* Only an execution with a rule can be part of a cycle */
+	if (child->param_rule == nullptr)
+		return false; 
+
+	/* If CHILD is the only execution of its rule, a cycle would have
+	 * to go through CHILD itself, which is not possible when CHILD
+	 * has no children, as is the case for new executions, unless
+	 * CHILD depends directly on itself */
+	if (counts_param_rule.at(child->param_rule.get()) == 1 &&
+	    child->children.empty() && child != parent)
+		return false; 
+
+	++cycle_searches; 
 	vector <Execution *> path;
 	path.push_back(parent); 
 	return find_cycle(path, child, dep_link); 
@@ -1077,13 +1447,19 @@ bool Execution::find_cycle(Execution *parent,
 
 bool Execution::find_cycle(vector <Execution *> &path,
 			   Execution *child,
-			   shared_ptr <const Dep> dep_link)
+			   const shared_ptr <const Dep> &dep_link)
 {
 	if (same_rule(path.back(), child)) {
 		cycle_print(path, dep_link); 
 		return true; 
 	}
 
+	/* An execution that was already visited in this search has no
+	 * ancestor with the same rule as CHILD */
+	if (path.back()->cycle_search == cycle_searches)
+		return false; 
+	path.back()->cycle_search= cycle_searches; 
+
 	for (auto &i:  path.back()->parents) {
 		Execution *next= i.first; 
 		assert(next != nullptr);
@@ -1098,7 +1474,7 @@ bool Execution::find_cycle(vector <Execution *> &path,
 }
 
 void Execution::cycle_print(const vector <Execution *> &path,
-			    shared_ptr <const Dep> dep)
+			    const shared_ptr <const Dep> &dep)
 /*
  * Given PATH = [a, b, c, d, ..., x], we print:
  *
@@ -1334,10 +1710,20 @@ Proceed Execution::execute_children()
 	return proceed_all; 
 }
 
-void Execution::push(shared_ptr <const Dep> dep)
+void Execution::push(const shared_ptr <const Dep> &dep)
 {
 	assert(dep); 
 	dep->check();
+
+	/* Concatenations of lists of plain dependencies are normalized
+	 * lazily by the buffer */
+	if (auto concat_dep= to <Concat_Dep> (dep)) {
+		vector <vector <shared_ptr <const Dep> > > parts; 
+		if (Concat_Dep::split_concat(concat_dep, parts)) {
+			buffer_A.push_product(concat_dep, move(parts)); 
+			return; 
+		}
+	}
 	
 	vector <shared_ptr <const Dep> > deps;
 	int e= 0;
@@ -1355,9 +1741,22 @@ void Execution::push(shared_ptr <const Dep> dep)
 		assert(d->is_normalized()); 
 		buffer_A.push(d);
 	}
+
+	/* Request the stat() of files which will be needed later */
+	if (Stat_Prefetch::enabled() && File_Execution::executions_by_pid_size == 0) {
+		for (const auto &d:  deps) {
+			auto plain_d= to <Plain_Dep> (d);
+			if (! plain_d || (plain_d->place_param_target.flags & F_TARGET_TRANSIENT))
+				continue;
+			const string &name= plain_d->place_param_target.place_name.unparametrized(); 
+			if (get_execution_by_target(Target(0, name)) == nullptr
+			    && ! Change_Journal::known(name.c_str()))
+				Stat_Prefetch::request(name.c_str()); 
+		}
+	}
 }
 
-Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
+Proceed Execution::execute_base_A(const shared_ptr <const Dep> &dep_this)
 {
 	Debug debug(this);
 
@@ -1449,8 +1848,8 @@ Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
 	return proceed |= P_FINISHED; 
 }
 
-Proceed Execution::connect(shared_ptr <const Dep> dep_this,
-			   shared_ptr <const Dep> dep_child)
+Proceed Execution::connect(const shared_ptr <const Dep> &dep_this,
+			   const shared_ptr <const Dep> &dep_child)
 {
 	Debug::print(this, fmt("connect %s",  dep_child->format_src())); 
 
@@ -1548,7 +1947,7 @@ void Execution::raise(int error_)
 }
 
 void Execution::disconnect(Execution *const child,
-			   shared_ptr <const Dep> dep_child)
+			   const shared_ptr <const Dep> &dep_child)
 {
 	Debug::print(this, fmt("disconnect %s", dep_child->format_src())); 
 
@@ -1618,12 +2017,15 @@ void Execution::disconnect(Execution *const child,
 	children.erase(child);
 	child->parents.erase(this);
 
-	/* Delete the Execution object */
+	/* Delete the Execution object, or free what it does not need
+	 * anymore */
 	if (child->want_delete())
 		delete child; 
+	else if (child->finished())
+		child->compact(); 
 }
 
-Proceed Execution::execute_base_B(shared_ptr <const Dep> dep_link)
+Proceed Execution::execute_base_B(const shared_ptr <const Dep> &dep_link)
 {
 	Proceed proceed= 0;
 	while (! buffer_B.empty()) {
@@ -1640,7 +2042,7 @@ Proceed Execution::execute_base_B(shared_ptr <const Dep> dep_link)
 	return proceed; 
 }
 
-Execution *Execution::get_execution(shared_ptr <const Dep> dep)
+Execution *Execution::get_execution(const shared_ptr <const Dep> &dep)
 {
 	/*
 	 * Non-cached executions
@@ -1679,17 +2081,16 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 	 * Cached executions
 	 */
 
-	const Target target= dep->get_target(); 
+	Target target= dep->get_target(); 
+	get_target_for_cache(target); 
+	/* Only the flags of file targets are removed, which does not
+	 * change any of the uses of TARGET below */
 
 	/* Set to the returned Execution object when one is found or created */    
-	Execution *execution= nullptr; 
+	Execution *execution= get_execution_by_target(target); 
 
-	const Target target_for_cache= get_target_for_cache(target); 
-	auto it= executions_by_target.find(target_for_cache);
-
-	if (it != executions_by_target.end()) {
+	if (execution != nullptr) {
 		/* An Execution object already exists for the target */ 
-		execution= it->second; 
 		if (execution->parents.count(this)) {
 			/* THIS and CHILD are already connected -- add the
 			 * necessary flags */ 
@@ -1697,12 +2098,11 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 			if (flags & ~execution->parents.at(this)->flags) {
 				shared_ptr <Dep> dep_new= Dep::clone(execution->parents.at(this));
 				dep_new->flags |= flags;
-				dep= dep_new;
 				/* No need to check for cycles here,
 				 * because a link between the two
 				 * already exists and therefore a cycle
 				 * cannot be present.  */
-				execution->parents[this]= dep; 
+				execution->parents[this]= dep_new; 
 			}
 		} else {
 			if (find_cycle(this, execution, dep)) {
@@ -1808,7 +2208,7 @@ void Execution::copy_result(Execution *parent, Execution *child)
 	}
 }
 
-void Execution::push_result(shared_ptr <const Dep> dd)
+void Execution::push_result(const shared_ptr <const Dep> &dd)
 {
 	Debug::print(this, fmt("push_result %s", dd->format_src())); 
 
@@ -1828,19 +2228,32 @@ void Execution::push_result(shared_ptr <const Dep> dd)
 	}
 }
 
-Target Execution::get_target_for_cache(Target target)
+void Execution::compact()
+{
+	assert(finished()); 
+	/* The buffers may contain trivial dependencies that were not
+	 * needed */
+	buffer_A.shrink(); 
+	buffer_B.shrink(); 
+}
+
+void Execution::get_target_for_cache(Target &target)
 {
 	if (target.is_file()) {
 		/* For file targets, we don't use flags for hashing. 
 		 * Zero is the word for file targets.  */
 		target.get_front_word_nondynamic()= (word_t)0; 
 	}
+}
 
-	return target; 
+Execution *Execution::get_execution_by_target(const Target &target)
+{
+	auto i= executions_by_target.find(target);
+	return i == executions_by_target.end() ? nullptr : i->second; 
 }
 
-shared_ptr <const Dep> Execution::append_top(shared_ptr <const Dep> dep, 
-					     shared_ptr <const Dep> top)
+shared_ptr <const Dep> Execution::append_top(const shared_ptr <const Dep> &dep, 
+					     const shared_ptr <const Dep> &top)
 {
 	assert(dep);
 	assert(top); 
@@ -1857,8 +2270,8 @@ shared_ptr <const Dep> Execution::append_top(shared_ptr <const Dep> dep,
 	return ret; 
 }
 
-shared_ptr <const Dep> Execution::set_top(shared_ptr <const Dep> dep,
-					  shared_ptr <const Dep> top)
+shared_ptr <const Dep> Execution::set_top(const shared_ptr <const Dep> &dep,
+					  const shared_ptr <const Dep> &top)
 {
 	assert(dep); 
 	assert(dep != top); 
@@ -1889,6 +2302,32 @@ File_Execution::~File_Execution()
 	}
 }
 
+void File_Execution::compact()
+{
+	Execution::compact(); 
+	assert(! job.started()); 
+
+	/* Only used while the job is running */
+	free(timestamps_old); 
+	timestamps_old= nullptr; 
+	if (filenames) {
+		for (size_t i= 0;  i < targets.size();  ++i) {
+			if (filenames[i]) {
+				free(filenames[i]); 
+			}
+		}
+		free(filenames); 
+		filenames= nullptr; 
+	}
+
+	/* Used by the job of the parent */ 
+	if (bits & B_STREAMED)
+		return;
+
+	mapping_parameter.clear(); 
+	mapping_variable.clear(); 
+}
+
 void File_Execution::wait() 
 /* We wait for a single job to finish, and then return so that the next
  * job can be started.  It would also be possible to process as many
@@ -1901,10 +2340,17 @@ void File_Execution::wait()
 	assert(File_Execution::executions_by_pid_size); 
 
 	int status;
-	const pid_t pid= Job::wait(&status); 
+	const pid_t pid= Job::wait(&status, 
+				   Dynamic_Execution::count_streaming 
+				   ? Dynamic_Execution::STREAM_INTERVAL_MS : -1); 
 
 	Debug::print(nullptr, frmt("pid = %ld", (long) pid)); 
 
+	/* Timeout:  return so that streamed dynamic dependencies are
+	 * read */
+	if (pid == 0)
+		return;
+
 	timestamp_last= Timestamp::now(); 
 
 	size_t mi= 0, ma= executions_by_pid_size - 1;
@@ -1973,6 +2419,15 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 	if (job.waited(status, pid)) {
 		/* Command was successful */ 
 
+		if (! job.commit_output()) {
+			assert(rule->redirect_index >= 0); 
+			rule->place_param_targets[rule->redirect_index]->place <<
+				system_format(targets[rule->redirect_index].format_word()); 
+			*this << ""; 
+			raise(ERROR_BUILD);
+			return;
+		}
+
 		bits |=  B_EXISTING; 
 		bits &= ~B_MISSING;
 		/* Subsequently set to B_MISSING if at least one target file is missing */
@@ -2046,25 +2501,7 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 	} else {
 		/* Command failed */ 
 		
-		string reason;
-		if (WIFEXITED(status)) {
-			reason= frmt("failed with exit status %s%d%s", 
-				     Color::word,
-				     WEXITSTATUS(status),
-				     Color::end);
-		} else if (WIFSIGNALED(status)) {
-			int sig= WTERMSIG(status);
-			reason= frmt("received signal %d (%s)", 
-				     sig,
-				     strsignal(sig));
-		} else {
-			/* This should not happen but the standard does not exclude
-			 * it  */ 
-			reason= frmt("failed with status %s%d%s",
-				     Color::word,
-				     status,
-				     Color::end); 
-		}
+		string reason= Job::format_status(status);
 
 		if (! param_rule->is_copy) {
 			Target target= parents.begin()->second->get_target(); 
@@ -2084,10 +2521,10 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 	}
 }
 
-File_Execution::File_Execution(shared_ptr <const Dep> dep,
+File_Execution::File_Execution(const shared_ptr <const Dep> &dep,
 			       Execution *parent, 
-			       shared_ptr <const Rule> rule_,
-			       shared_ptr <const Rule> param_rule_,
+			       const shared_ptr <const Rule> &rule_,
+			       const shared_ptr <const Rule> &param_rule_,
 			       map <string, string> &mapping_parameter_,
 			       int &error_additional)
 	:  Execution(param_rule_),
@@ -2148,7 +2585,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 				/* Check that the file is present,
 				 * or make it an error */ 
 				struct stat buf;
-				int ret_stat= stat(target_.get_name_c_str_nondynamic(), &buf);
+				int ret_stat= Change_Journal::stat(target_.get_name_c_str_nondynamic(), &buf);
 				if (0 > ret_stat) {
 					if (errno != ENOENT) {
 						string text= target_.format_word();
@@ -2338,6 +2775,9 @@ bool File_Execution::remove_if_existing(bool output)
 	/* [ASYNC-SIGNAL-SAFE] We use only async signal-safe functions
 	 * here, if OUTPUT is false  */
 
+	/* The target itself was not written by the job (-A) */ 
+	job.remove_output(); 
+
 	if (option_no_delete)
 		return false;
 
@@ -2503,7 +2943,7 @@ void File_Execution::print_command() const
 	}
 }
 
-Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed File_Execution::execute(const shared_ptr <const Dep> &dep_this)
 {
 	assert(! job.started() || children.empty()); 
 
@@ -2523,6 +2963,49 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 	
 	Debug debug(this);
 
+	if (dep_this->flags & F_STREAMED && 
+	    ! (dep_this->flags & (F_INPUT | F_RESULT_NOTIFY))) {
+		dep_this->get_place() <<
+			fmt("dependency %s with flag %s must use input redirection or be dynamic",
+			    dep_this->format_word(), 
+			    multichar_format_word("-s")); 
+		*this << ""; 
+		raise(ERROR_LOGICAL); 
+		done |= done_from_flags(dep_this->flags); 
+		return proceed |= P_ABORT | P_FINISHED; 
+	}
+
+	/* A streamed input dependency (-s):  the file is not built, and
+	 * its command is run by the job of the parent, with output into
+	 * a pipe.  Its timestamp is that of its dependencies.  */
+	if (bits & B_STREAMED || 
+	    (dep_this->flags & (F_STREAMED | F_INPUT)) == (F_STREAMED | F_INPUT)) {
+		if ((dep_this->flags & (F_STREAMED | F_INPUT)) != (F_STREAMED | F_INPUT)) {
+			dep_this->get_place() <<
+				fmt("streamed input dependency %s must not also be used without flag %s",
+				    targets.front().format_word(), 
+				    multichar_format_word("-s")); 
+			*this << ""; 
+			raise(ERROR_LOGICAL); 
+			done |= done_from_flags(dep_this->flags); 
+			return proceed |= P_ABORT | P_FINISHED; 
+		}
+		if (rule == nullptr || rule->command == nullptr || 
+		    rule->is_hardcode || rule->redirect_index < 0 || 
+		    targets.size() != 1) {
+			(rule == nullptr ? dep_this->get_place() : rule->place) <<
+				fmt("streamed input dependency %s must be built by a command with output redirection", 
+				    targets.front().format_word()); 
+			*this << ""; 
+			raise(ERROR_LOGICAL); 
+			done |= done_from_flags(dep_this->flags); 
+			return proceed |= P_ABORT | P_FINISHED; 
+		}
+		bits |= B_STREAMED; 
+		done |= done_from_flags(dep_this->flags); 
+		return proceed |= P_FINISHED; 
+	}
+
 	if (finished(dep_this->flags)) {
 		assert(! (proceed & P_WAIT)); 
 		return proceed |= P_FINISHED; 
@@ -2591,7 +3074,17 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 
 			/* We save the return value of stat() and handle errors later */ 
 			struct stat buf;
-			int ret_stat= stat(target.get_name_c_str_nondynamic(), &buf);
+			int ret_stat;
+			if (rule != nullptr && ! no_execution 
+			    && ! (dep_this->flags & F_OPTIONAL)
+			    && Dir_Cache::missing(target.get_name_c_str_nondynamic())) {
+				ret_stat= -1;
+				errno= ENOENT; 
+			} else {
+				ret_stat= Change_Journal::stat(target.get_name_c_str_nondynamic(), &buf);
+				if (ret_stat < 0 && errno == ENOENT)
+					Dir_Cache::miss(target.get_name_c_str_nondynamic()); 
+			}
 
 			/* Warn when file has timestamp in the future */ 
 			if (ret_stat == 0) { 
@@ -2758,6 +3251,10 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 		Debug::print(this, "create_content"); 
 
 		print_command();
+		Stat_Prefetch::modified(); 
+		Change_Journal::modified(); 
+		Dir_Cache::created(targets.front().get_name_c_str_nondynamic()); 
+		Change_Journal::created(targets.front().get_name_c_str_nondynamic()); 
 		write_content(targets.front().get_name_c_str_nondynamic(), *(rule->command)); 
 		done= ~0;
 		assert(proceed == 0); 
@@ -2772,9 +3269,27 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
        
 	/* We have to start a job now */ 
 
+	/* The command of a streamed input dependency (-s) is run by the
+	 * same job */ 
+	File_Execution *execution_stream= nullptr;
+	if (! rule->is_copy && ! rule->filename.empty()) {
+		execution_stream= dynamic_cast <File_Execution *> 
+			(get_execution_by_target(Target(0, rule->filename.unparametrized()))); 
+		if (execution_stream && ! (execution_stream->bits & B_STREAMED))
+			execution_stream= nullptr; 
+	}
+
+	if (execution_stream)
+		execution_stream->print_command(); 
 	print_command();
+	Stat_Prefetch::modified(); 
+	Change_Journal::modified(); 
 
 	for (const Target &target:  targets) {
+		if (target.is_file()) {
+			Dir_Cache::created(target.get_name_c_str_nondynamic()); 
+			Change_Journal::created(target.get_name_c_str_nondynamic()); 
+		}
 		if (! target.is_transient())  
 			continue; 
 		Timestamp timestamp_now= Timestamp::now(); 
@@ -2789,15 +3304,12 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 	assert(jobs >= 1); 
 	
 	/* Key/value pairs for all environment variables of the job.
-	 * Variables override parameters.  
-	 * Note about C++ map::insert():  The insert function is a no-op
-	 * if a key is already present.  Thus, we insert variables first
-	 * (because they have priority).  */
+	 * Variables override parameters; this is done by the job.  The
+	 * values of variables are not copied.  */
 	map <string, string> mapping;
-	mapping.insert(mapping_variable.begin(), mapping_variable.end());
-	mapping.insert(mapping_parameter.begin(), mapping_parameter.end());
-	mapping_parameter.clear();
-	mapping_variable.clear(); 
+	Variables variables; 
+	swap(mapping, mapping_parameter); 
+	swap(variables, mapping_variable); 
 
 	pid_t pid; 
 	size_t index; /* In EXECUTIONS_BY_PID_* */
@@ -2821,7 +3333,7 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			 * exists in the cache */
 			if (rule->deps.at(0)->flags & F_OPTIONAL) {
 				Execution *execution_source_base=
-					executions_by_target.at(Target(0, source));
+					get_execution_by_target(Target(0, source));
 				assert(execution_source_base); 
 				File_Execution *execution_source
 					= dynamic_cast <File_Execution *> (execution_source_base); 
@@ -2847,14 +3359,25 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 				(rule->place_param_targets[0]->place_name.unparametrized(),
 				 source);
 		} else {
+			Job::Stream stream; 
+			if (execution_stream) {
+				stream.filename= rule->filename.unparametrized(); 
+				stream.command= execution_stream->rule->command->command; 
+				stream.place= execution_stream->rule->command->place; 
+				stream.mapping= execution_stream->mapping_parameter; 
+				stream.variables= execution_stream->mapping_variable; 
+			}
+
 			pid= job.start
 				(rule->command->command, 
 				 mapping,
+				 variables,
 				 rule->redirect_index < 0 ? "" :
 				 rule->place_param_targets[rule->redirect_index]
 				 ->place_name.unparametrized(),
 				 rule->filename.unparametrized(),
-				 rule->command->place); 
+				 rule->command->place,
+				 execution_stream ? &stream : nullptr); 
 		}
 
 		assert(pid != 0 && pid != 1); 
@@ -2946,7 +3469,35 @@ void File_Execution::print_as_job() const
 void File_Execution::write_content(const char *filename, 
 				   const Command &command)
 {
-	FILE *file= fopen(filename, "w"); 
+	/* The file may exist even though it was considered missing,
+	 * e.g., when it was created as a side effect of another command
+	 * after its directory was listed (see dircache.hh).  Leave it
+	 * untouched if it has the right content, such that its
+	 * dependents are not rebuilt.  */
+	struct stat buf;
+	if (0 == stat(filename, &buf) && S_ISREG(buf.st_mode) && 
+	    is_content_unchanged(filename, buf.st_size, command)) {
+		Debug::print(this, "content unchanged"); 
+		++ Job::count_content_unchanged; 
+		bits |= B_EXISTING;
+		bits &= ~B_MISSING; 
+		return;
+	}
+
+	/* With -A, write into a temporary file and move it into place */ 
+	string filename_tmp; 
+	FILE *file; 
+	if (option_atomic) {
+		int fd= Job::open_atomic(filename, filename_tmp); 
+		file= fd < 0 ? nullptr : fdopen(fd, "w"); 
+		if (fd >= 0 && file == nullptr) {
+			close(fd); 
+			if (! filename_tmp.empty())
+				unlink(filename_tmp.c_str()); 
+		}
+	} else {
+		file= fopen(filename, "w"); 
+	}
 
 	if (file == nullptr) {
 		rule->place << system_format(name_format_word(filename)); 
@@ -2958,18 +3509,38 @@ void File_Execution::write_content(const char *filename,
 		if (fwrite(line.c_str(), 1, line.size(), file) != line.size()) {
 			assert(ferror(file));
 			fclose(file); 
+			if (! filename_tmp.empty())
+				unlink(filename_tmp.c_str()); 
 			rule->place <<
 				system_format(name_format_word(filename)); 
 			raise(ERROR_BUILD); 
+			return;
 		}
 		if (EOF == putc('\n', file)) {
 			fclose(file); 
+			if (! filename_tmp.empty())
+				unlink(filename_tmp.c_str()); 
 			rule->place <<
 				system_format(name_format_word(filename)); 
 			raise(ERROR_BUILD); 
+			return;
 		}
 	}
 
+	if (option_atomic && 
+	    (0 != fflush(file) || 
+	     ! Job::link_atomic(fileno(file), filename_tmp, filename))) {
+		int errno_save= errno; 
+		fclose(file); 
+		if (! filename_tmp.empty())
+			unlink(filename_tmp.c_str()); 
+		errno= errno_save; 
+		rule->place <<
+			system_format(name_format_word(filename)); 
+		raise(ERROR_BUILD); 
+		return;
+	}
+
 	if (0 != fclose(file)) {
 		rule->place <<
 			system_format(name_format_word(filename)); 
@@ -2983,7 +3554,43 @@ void File_Execution::write_content(const char *filename,
 	bits &= ~B_MISSING; 
 }
 
-void File_Execution::read_variable(shared_ptr <const Dep> dep)
+bool File_Execution::is_content_unchanged(const char *filename, 
+					  off_t size,
+					  const Command &command)
+{
+	/* Compare the size first, to avoid reading the file */ 
+	const vector <string> &lines= command.get_lines(); 
+	off_t size_content= 0;
+	for (const string &line:  lines) 
+		size_content += line.size() + 1;
+	if (size != size_content)
+		return false;
+	if (size == 0)
+		return true; 
+
+	int fd= open(filename, O_RDONLY | O_CLOEXEC); 
+	if (fd < 0)
+		return false;
+	void *p= mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0); 
+	close(fd); 
+	if (p == MAP_FAILED)
+		return false;
+
+	bool ret= true;
+	const char *q= (const char *) p; 
+	for (const string &line:  lines) {
+		if (memcmp(q, line.c_str(), line.size()) || q[line.size()] != '\n') {
+			ret= false;
+			break;
+		}
+		q += line.size() + 1; 
+	}
+
+	munmap(p, size); 
+	return ret; 
+}
+
+void File_Execution::read_variable(const shared_ptr <const Dep> &dep)
 {
 	Debug::print(this, fmt("read_variable %s", dep->format_src())); 
 	
@@ -3013,7 +3620,9 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 	size_t filesize;
 	struct stat buf;
 	string dependency_variable_name;
-	string content; 
+	shared_ptr <const string> content; 
+	void *mapped= nullptr; 
+	const char *begin, *end; 
 	
 	int fd= open(target.get_name_c_str_nondynamic(), O_RDONLY);
 	if (fd < 0) {
@@ -3027,23 +3636,37 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 		goto error_fd;
 	}
 
+	/* The file is mapped into memory rather than read, such that
+	 * the value is copied only once, after the removal of space.
+	 * This works for files of any size.  */
 	filesize= buf.st_size;
-	content.resize(filesize);
-	if ((ssize_t) filesize != read(fd, (void *) content.c_str(), filesize)) {
-		dep->get_place() << target.format_word(); 
-		goto error_fd;
+	if (filesize != 0) {
+		mapped= mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fd, 0); 
+		if (mapped == MAP_FAILED) {
+			dep->get_place() << system_format(target.format_word()); 
+			goto error_fd;
+		}
 	}
 
 	if (0 > close(fd)) { 
 		dep->get_place() << target.format_word(); 
+		if (mapped)
+			munmap(mapped, filesize); 
 		goto error;
 	}
 
 	/* Remove space at beginning and end of the content.
 	 * The characters are exactly those used by isspace() in
 	 * the C locale.  */ 
-	content.erase(0, content.find_first_not_of(" \n\t\f\r\v")); 
-	content.erase(content.find_last_not_of(" \n\t\f\r\v") + 1);  
+	begin= mapped ? (const char *) mapped : "";
+	end= begin + filesize; 
+	while (begin < end && strchr(" \n\t\f\r\v", *begin) && *begin)
+		++begin;
+	while (end > begin && strchr(" \n\t\f\r\v", end[-1]) && end[-1])
+		--end;
+	content= make_shared <const string> (begin, end - begin); 
+	if (mapped)
+		munmap(mapped, filesize); 
 
 	/* The variable name */ 
 	dependency_variable_name=
@@ -3054,6 +3677,7 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 			dependency_variable_name == "" ?
 			target.get_name_nondynamic() : dependency_variable_name;
 
+		/* The value is shared with all parents */
 		result_variable[variable_name]= content; 
 	}
 
@@ -3084,7 +3708,7 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 	raise(ERROR_BUILD); 
 }
 
-bool File_Execution::optional_finished(shared_ptr <const Dep> dep_link)
+bool File_Execution::optional_finished(const shared_ptr <const Dep> &dep_link)
 {
 	if ((dep_link->flags & F_OPTIONAL) 
 	    && to <Plain_Dep> (dep_link)
@@ -3101,7 +3725,7 @@ bool File_Execution::optional_finished(shared_ptr <const Dep> dep_link)
 			->place_param_target.place_name.unparametrized().c_str();
 
 		struct stat buf;
-		int ret_stat= stat(name, &buf);
+		int ret_stat= Change_Journal::stat(name, &buf);
 		if (ret_stat < 0) {
 			bits |= B_MISSING;
 			bits &= ~B_EXISTING; 
@@ -3145,7 +3769,7 @@ Root_Execution::Root_Execution(const vector <shared_ptr <const Dep> > &deps)
 	}
 }
 
-Proceed Root_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Root_Execution::execute(const shared_ptr <const Dep> &dep_this)
 {
 	/* This is an example of a "plain" execute() function,
 	 * containing the minimal wrapper around execute_base_?()  */ 
@@ -3173,7 +3797,7 @@ Proceed Root_Execution::execute(shared_ptr <const Dep> dep_this)
 	return proceed; 
 }
 
-Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
+Concat_Execution::Concat_Execution(const shared_ptr <const Concat_Dep> &dep_,
 				   Execution *parent,
 				   int &error_additional)
 	:  dep(dep_),
@@ -3228,7 +3852,7 @@ Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
 	}
 }
 
-Proceed Concat_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Concat_Execution::execute(const shared_ptr <const Dep> &dep_this)
 {
  again:
 	assert(stage <= 2); 
@@ -3296,8 +3920,11 @@ void Concat_Execution::launch_stage_1()
 		raise(e); 
 	}
 			
-	for (auto f:  deps) {
-		shared_ptr <Dep> f2= Dep::clone(f); 
+	/* Release C, so that dependencies not shared otherwise can be
+	 * modified without being cloned */ 
+	c= nullptr; 
+	for (auto &f:  deps) {
+		shared_ptr <Dep> f2= Dep::clone_if_shared(move(f)); 
 		/* Add -% flag */
 		f2->flags |= F_RESULT_COPY;
 		/* Add flags from self */  
@@ -3310,10 +3937,10 @@ void Concat_Execution::launch_stage_1()
 	}
 }
 
-void Concat_Execution::notify_result(shared_ptr <const Dep> d, 
+void Concat_Execution::notify_result(const shared_ptr <const Dep> &d, 
 				     Execution *source, 
 				     Flags flags,
-				     shared_ptr <const Dep> dep_source)
+				     const shared_ptr <const Dep> &dep_source)
 {
 	(void) source; 
 
@@ -3338,11 +3965,14 @@ void Concat_Execution::notify_result(shared_ptr <const Dep> d,
 	}
 }
 
-Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
+Dynamic_Execution::Dynamic_Execution(const shared_ptr <const Dynamic_Dep> &dep_,
 				     Execution *parent,
 				     int &error_additional)
 	:  dep(dep_),
-	   is_finished(false)
+	   is_finished(false),
+	   is_streaming(false),
+	   offset_stream(0),
+	   line_stream(0)
 {
 	assert(dep_); 
 	assert(dep_->is_normalized()); 
@@ -3373,8 +4003,10 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 			shared_ptr <const Rule> rule= 
 				rule_set.get(target_base, param_rule, mapping_parameter, 
 					     dep->get_place()); 
+			count_param_rule(); 
 		} catch (int e) {
 			assert(e); 
+			count_param_rule(); 
 			*this << ""; 
 			error_additional |= e;
 			raise(e); 
@@ -3383,6 +4015,27 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 		executions_by_target[target]= this; 
 	}
 
+	/* Streamed dynamic dependency (-s) */ 
+	if (auto plain_dep= to <const Plain_Dep> (dep->dep)) {
+		if (plain_dep->flags & F_STREAMED) {
+			if (! (plain_dep->flags & (F_NEWLINE_SEPARATED | F_NUL_SEPARATED))) {
+				plain_dep->get_place() << 
+					fmt("streamed dynamic dependency %s must be declared with flag %s or %s",
+					    dep->format_word(), 
+					    multichar_format_word("-n"), 
+					    multichar_format_word("-0")); 
+				*this << ""; 
+				error_additional |= ERROR_LOGICAL;
+				raise(ERROR_LOGICAL); 
+				return; 
+			}
+			if (! (plain_dep->place_param_target.flags & F_TARGET_TRANSIENT)) {
+				is_streaming= true; 
+				++count_streaming; 
+			}
+		}
+	}
+
 	parents.erase(parent); 
 	if (find_cycle(parent, this, dep)) {
 		parent->raise(ERROR_LOGICAL);
@@ -3397,8 +4050,20 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 	push(dep_child); 
 }
 
-Proceed Dynamic_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Dynamic_Execution::execute(const shared_ptr <const Dep> &dep_this)
 {
+	/* Read what the job has written to the streamed file so far.
+	 * The dependencies are then started by execute_base_A().  */
+	if (is_streaming) {
+		auto plain_dep= to <const Plain_Dep> (dep->dep); 
+		Target target(0, plain_dep->place_param_target.place_name.unparametrized()); 
+		if (auto execution= dynamic_cast <File_Execution *> (get_execution_by_target(target))) {
+			vector <shared_ptr <const Dep> > deps; 
+			execution->read_stream(this, false, offset_stream, line_stream, deps); 
+			push_dynamic(deps); 
+		}
+	}
+
 	Proceed proceed= execute_base_A(dep_this); 
 	assert(proceed); 
 	if (proceed & (P_WAIT | P_PENDING)) {
@@ -3442,10 +4107,10 @@ string Dynamic_Execution::format_src() const
 	return dep->format_src();
 }
 
-void Dynamic_Execution::notify_result(shared_ptr <const Dep> d, 
+void Dynamic_Execution::notify_result(const shared_ptr <const Dep> &d, 
 				      Execution *source, 
 				      Flags flags,
-				      shared_ptr <const Dep> dep_source)
+				      const shared_ptr <const Dep> &dep_source)
 {
 	assert(!(flags & ~(F_RESULT_NOTIFY | F_RESULT_COPY))); 
 	assert((flags & ~(F_RESULT_NOTIFY | F_RESULT_COPY)) != (F_RESULT_NOTIFY | F_RESULT_COPY)); 
@@ -3453,34 +4118,53 @@ void Dynamic_Execution::notify_result(shared_ptr <const Dep> d,
 
 	if (flags & F_RESULT_NOTIFY) {
 		vector <shared_ptr <const Dep> > deps; 
-		source->read_dynamic(to <const Plain_Dep> (d), deps, dep, this); 
-		for (auto &j:  deps) {
-			shared_ptr <Dep> j_new= Dep::clone(j); 
-			/* Add -% flag */
-			j_new->flags |= F_RESULT_COPY;
-			/* Add flags from self */  
-			j_new->flags |= dep->flags & (F_TARGET_BYTE & ~F_TARGET_DYNAMIC); 
-			for (unsigned i= 0;  i < C_PLACED;  ++i) {
-				if (j_new->get_place_flag(i).empty() && 
-				    ! dep->get_place_flag(i).empty())
-					j_new->set_place_flag(i, dep->get_place_flag(i)); 
-			}
-			j= j_new; 
-			push(j); 
+		if (is_streaming) {
+			is_streaming= false;
+			assert(count_streaming); 
+			--count_streaming; 
 		}
+		if (offset_stream) {
+			/* Only read the rest of a streamed file */ 
+			auto execution= dynamic_cast <File_Execution *> (source); 
+			assert(execution); 
+			/* Don't read the rest when the job failed */ 
+			if (! execution->get_error())
+				execution->read_stream(this, true, offset_stream, line_stream, deps); 
+		} else {
+			source->read_dynamic(to <const Plain_Dep> (d), deps, dep, this); 
+		}
+		push_dynamic(deps); 
 	} else {
 		assert(flags & F_RESULT_COPY);
 		push_result(d); 
 	}
 }
 
+void Dynamic_Execution::push_dynamic(vector <shared_ptr <const Dep> > &deps)
+{
+	for (auto &j:  deps) {
+		shared_ptr <Dep> j_new= Dep::clone_if_shared(move(j)); 
+		/* Add -% flag */
+		j_new->flags |= F_RESULT_COPY;
+		/* Add flags from self */  
+		j_new->flags |= dep->flags & (F_TARGET_BYTE & ~F_TARGET_DYNAMIC); 
+		for (unsigned i= 0;  i < C_PLACED;  ++i) {
+			if (j_new->get_place_flag(i).empty() && 
+			    ! dep->get_place_flag(i).empty())
+				j_new->set_place_flag(i, dep->get_place_flag(i)); 
+		}
+		j= j_new; 
+		push(j); 
+	}
+}
+
 Transient_Execution::~Transient_Execution()
 /* Objects of this type are never deleted */ 
 {
 	assert(false);
 }
 
-Proceed Transient_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Transient_Execution::execute(const shared_ptr <const Dep> &dep_this)
 {
 	Proceed proceed= execute_base_A(dep_this); 
 	assert(proceed); 
@@ -3494,6 +4178,14 @@ Proceed Transient_Execution::execute(shared_ptr <const Dep> dep_this)
 	return proceed; 
 }
 
+void Transient_Execution::compact()
+{
+	Execution::compact(); 
+	rule= nullptr; 
+	mapping_parameter.clear(); 
+	mapping_variable.clear(); 
+}
+
 bool Transient_Execution::finished() const
 {
 	return is_finished; 
@@ -3504,10 +4196,10 @@ bool Transient_Execution::finished(Flags) const
 	return is_finished; 
 }
 
-Transient_Execution::Transient_Execution(shared_ptr <const Dep> dep_link,
+Transient_Execution::Transient_Execution(const shared_ptr <const Dep> &dep_link,
 					 Execution *parent,
-					 shared_ptr <const Rule> rule_,
-					 shared_ptr <const Rule> param_rule_,
+					 const shared_ptr <const Rule> &rule_,
+					 const shared_ptr <const Rule> &param_rule_,
 					 map <string, string> &mapping_parameter_,
 					 int &error_additional)
 	:  Execution(param_rule_),
@@ -3593,15 +4285,14 @@ string Transient_Execution::format_src() const {
 	return targets.front().format_src(); 
 }
 
-void Transient_Execution::notify_result(shared_ptr <const Dep> dep,
+void Transient_Execution::notify_result(const shared_ptr <const Dep> &dep,
 					Execution *,
 					Flags flags,
-					shared_ptr <const Dep> dep_source)
+					const shared_ptr <const Dep> &dep_source)
 {
 	assert(flags == F_RESULT_COPY); 
 	assert(dep_source);
-	dep= append_top(dep, dep_source); 
-	push_result(dep); 
+	push_result(append_top(dep, dep_source)); 
 }
 
 void Debug::print(const Execution *e, string text) 
@@ -43,16 +43,18 @@ enum
 	I_TARGET_DYNAMIC,	/* [ ] \ target flags      |                    */
 	I_TARGET_TRANSIENT,	/* @   /                   |                    */
 	I_VARIABLE,		/* $                       |                    */
-	I_NEWLINE_SEPARATED,	/* -n  \ attribute flags   |                    */
-	I_NUL_SEPARATED,	/* -0  /                  /                     */
+	I_NEWLINE_SEPARATED,	/* -n  \                   |                    */
+	I_NUL_SEPARATED,	/* -0   | attribute flags  |                    */
+	I_MAKE_DEPFILE,		/* -d  /                   |                    */
+	I_STREAMED,		/* -s                     /                     */
 	I_INPUT,		/* <                                            */
 	I_RESULT_NOTIFY,        /* -*                                           */
 	I_RESULT_COPY,          /* -%                                           */
 
 	C_ALL,                 
 	C_PLACED           	= 3,  /* Flags for which we store a place in Dep */
-	C_WORD			= 8,  /* Flags used for caching; they are stored in Target */
-#define C_WORD			  8 /* Used statically */
+	C_WORD			= 10, /* Flags used for caching; they are stored in Target */
+#define C_WORD			  10 /* Used statically */
 	/* The last #define can be replaced with template trickery, yes,
 	 * but it makes it much longer.  Accept the duplicate constant
 	 * for now.  */
@@ -87,6 +89,14 @@ enum
 	/* For dynamic dependencies, the file contains NUL-separated
 	 * filenames, without any markup  */ 
 
+	F_MAKE_DEPFILE		= 1 << I_MAKE_DEPFILE,
+	/* For dynamic dependencies, the file is a dependency file in
+	 * Make syntax, as generated by compilers, e.g. 'cc -MD' */ 
+
+	F_STREAMED		= 1 << I_STREAMED,
+	/* (-s) For dynamic dependencies with -n or -0, the file is read
+	 * while it is being generated  */
+
 	F_INPUT 		= 1 << I_INPUT,
 	/* A dependency is annotated with the input redirection flag '<' */
 
@@ -104,7 +114,7 @@ enum
 	F_PLACED	= (1 << C_PLACED) - 1,
 	F_TARGET_BYTE	= (1 << C_WORD) - 1,
 	F_TARGET	= F_TARGET_DYNAMIC | F_TARGET_TRANSIENT,
-	F_ATTRIBUTE	= F_NEWLINE_SEPARATED | F_NUL_SEPARATED,
+	F_ATTRIBUTE	= F_NEWLINE_SEPARATED | F_NUL_SEPARATED | F_MAKE_DEPFILE,
 };
 
 /* 
@@ -128,7 +138,7 @@ enum
 	D_ALL_OPTIONAL		  	= D_NONPERSISTENT_TRANSIENT | D_NONPERSISTENT_NONTRANSIENT,
 };
 
-const char *const FLAGS_CHARS= "pot[@$n0<*%"; 
+const char *const FLAGS_CHARS= "pot[@$n0ds<*%"; 
 /* Characters representing the individual flags -- used in debug mode
  * output, and in other cases  */ 
 
@@ -147,6 +157,8 @@ unsigned flag_get_index(char c)
 	case 't':  return I_TRIVIAL;
 	case 'n':  return I_NEWLINE_SEPARATED;
 	case '0':  return I_NUL_SEPARATED;
+	case 'd':  return I_MAKE_DEPFILE;
+	case 's':  return I_STREAMED;
 		
 	default:
 		assert(false);
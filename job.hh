@@ -17,6 +17,11 @@ void job_terminate_all();
 
 void job_print_jobs(); 
 
+typedef map <string, shared_ptr <const string> > Variables;
+/* The values of variable dependencies ($[...]) by variable name.  The
+ * values may be large, and are therefore shared by all executions that
+ * use them instead of being copied.  */
+
 /* 
  * Macro to write in an async signal-safe manner. 
  *   - FD must be '1' or '2'.
@@ -55,7 +60,21 @@ class Job
 {
 public:
 
-	Job():  pid(-2) { }
+	struct Stream
+	/* A command whose output is piped into the input of the job,
+	 * for a streamed input dependency (-s).  */
+	{
+		string filename;
+		/* The streamed file; it is not written */ 
+
+		string command;
+		map <string, string> mapping;
+		Variables variables; 
+		Place place; 
+		/* As in start() */
+	};
+
+	Job():  pid(-2), fd_atomic(-1) { }
 
 	bool waited(int status, pid_t pid_check);
 	/* Called after having returned this process from wait_do().
@@ -78,24 +97,35 @@ public:
 
 	pid_t start(string command, 
 		    const map <string, string> &mapping,
+		    const Variables &variables,
 		    string filename_output,
 		    string filename_input,
-		    const Place &place_command); 
+		    const Place &place_command,
+		    const Stream *stream= nullptr); 
 	/* Start the process.  Don't output the command -- this is done
 	 * by callers of this functions.  FILENAME_OUTPUT and
 	 * FILENAME_INPUT are the files into which to redirect output
 	 * and input; either can be empty to denote no redirection.  On
 	 * error, output a message and return -1, otherwise return the
-	 * PID (>= 0).  MAPPING contains the environment variables to
-	 * set.  */
+	 * PID (>= 0).  MAPPING and VARIABLES contain the environment
+	 * variables to set; VARIABLES have priority.  When STREAM is
+	 * not null, its command is run at the same time, with its
+	 * output piped into the input of the command, and
+	 * FILENAME_INPUT is not used.  The process then waits for both,
+	 * and fails when one of them fails.  With the -A option, the
+	 * output is written into a temporary file, which is moved to
+	 * FILENAME_OUTPUT by commit_output().  */
 
 	pid_t start_copy(string target, string source);
 	/* Start a copy job.  The return value has the same semantics as
 	 * in start().  */  
 
-	static pid_t wait(int *status);
+	static pid_t wait(int *status, int timeout= -1);
 	/* Wait for the next process to terminate; provide the STATUS as
-	 * used in wait(2).  Return the PID of the waited-for process (>=0). */  
+	 * used in wait(2).  Return the PID of the waited-for process (>=0). 
+	 * When TIMEOUT is not negative, return zero when no process
+	 * has terminated after TIMEOUT milliseconds.  On systems
+	 * without sigtimedwait(), TIMEOUT is ignored.  */  
 
 	static void print_statistics(bool allow_unterminated_jobs= false); 
 	/* Print the statistics about jobs, regardless of OPTION_STATISTICS.  If
@@ -104,6 +134,33 @@ public:
 	static void kill(pid_t pid); 
 	/* Kill this job */
 
+	static size_t count_content_unchanged; 
+	/* Files of content rules that were not rewritten because their
+	 * content was unchanged; for the statistics (-z) */
+
+	static string format_status(int status); 
+	/* The reason of failure given the STATUS as used in wait(2),
+	 * e.g. "failed with exit status 1" */
+
+	bool commit_output(); 
+	/* Called after the job has succeeded:  move the temporary
+	 * output file into the target file (-A).  Return FALSE on
+	 * error, with ERRNO set.  */
+
+	void remove_output(); 
+	/* Remove the temporary output file of a job that was started
+	 * (-A).  [ASYNC-SIGNAL-SAFE]  */
+
+	static int open_atomic(const string &filename, string &filename_tmp); 
+	/* Open a temporary file in the same directory as FILENAME, for
+	 * writing FILENAME atomically (-A).  FILENAME_TMP is set to its
+	 * name, or to "" when the file is anonymous (O_TMPFILE).  Return
+	 * the file descriptor, or -1 on error with ERRNO set.  */
+
+	static bool link_atomic(int fd, string &filename_tmp, const string &filename); 
+	/* Move the temporary file opened by open_atomic() to FILENAME.
+	 * FD is not closed.  Return FALSE on error, with ERRNO set.  */
+
 	static void init_tty(); 
 
 	static pid_t get_tty()  {  return tty;  }
@@ -134,9 +191,48 @@ private:
 	 * -1:    process has been waited for. 
 	 */
 
+	int fd_atomic; 
+	/* The temporary output file (-A), kept open by Stu until the
+	 * job is finished; -1 when not used */
+
+	string filename_atomic, filename_tmp; 
+	/* The target file and the name of the temporary file (-A); the
+	 * latter is "" for an anonymous file */
+
 	static void handler_termination(int sig);
 	static void handler_productive(int sig, siginfo_t *, void *);
+
+	/* The following functions are called in the child process, and
+	 * terminate it on error */ 
+	static void exec_command(const char *shell,
+				 string command,
+				 const map <string, string> &mapping,
+				 const Variables &variables,
+				 const Place &place_command) 
+		__attribute__ ((noreturn));
+	static char *combine(const string &key, const string &value); 
+	/* Return "KEY=VALUE" in newly allocated memory */ 
+
+	static void redirect_output(const string &filename_output);
+	static void redirect_input(const string &filename_input);
+	static void exec_stream(const char *shell,
+				string command,
+				const map <string, string> &mapping,
+				const Variables &variables,
+				const string &filename_output,
+				const Place &place_command,
+				const Stream &stream)
+		__attribute__ ((noreturn));
 	
+	static bool check_environment(const string &command, 
+				      const map <string, string> &mapping,
+				      const Variables &variables,
+				      const Place &place_command); 
+	/* Check that the command and its environment variables do not
+	 * exceed the limits of execve(), which would otherwise fail in
+	 * the child process.  On error, output a message and return
+	 * FALSE.  */
+
 	static void init_signals(); 
 	/* Set up all signals.   May be called multiple times, and will
 	 * do the setup only the first time  */
@@ -174,6 +270,7 @@ private:
 size_t Job::count_jobs_exec=    0;
 size_t Job::count_jobs_success= 0;
 size_t Job::count_jobs_fail=    0;
+size_t Job::count_content_unchanged= 0; 
 sigset_t Job::set_termination;
 sigset_t Job::set_productive;
 sigset_t Job::set_termination_productive;
@@ -188,9 +285,11 @@ bool Job::Signal_Blocker::blocked= false;
 
 pid_t Job::start(string command,
 		 const map <string, string> &mapping,
+		 const Variables &variables,
 		 string filename_output,
 		 string filename_input,
-		 const Place &place_command)
+		 const Place &place_command,
+		 const Stream *stream)
 {
 	assert(pid == -2); 
 
@@ -214,16 +313,37 @@ pid_t Job::start(string command,
 		if (shell == nullptr || shell[0] == '\0') 
 			shell= "/bin/sh"; 
 	}
-	
-	const char *arg= command.c_str(); 
-	/* c_str() never returns nullptr, as by the standard */ 
-	assert(arg != nullptr);
+
+	if (! check_environment(command, mapping, variables, place_command) ||
+	    (stream != nullptr && 
+	     ! check_environment(stream->command, stream->mapping, 
+				 stream->variables, stream->place))) {
+		pid= -1;
+		return -1; 
+	}
+
+	/* With -A, the output file is opened by Stu, such that it can
+	 * be moved into place after the job has succeeded.  Readers
+	 * thus never see a partially written file, and a failed or
+	 * interrupted job leaves the target untouched.  */
+	if (option_atomic && filename_output != "") {
+		fd_atomic= open_atomic(filename_output, filename_tmp); 
+		if (fd_atomic < 0) {
+			print_error_system(filename_output); 
+			pid= -1;
+			return -1; 
+		}
+		filename_atomic= filename_output; 
+	}
 
 	pid= fork();
 
 	if (pid < 0) {
 		print_error_system("fork"); 
 		assert(pid == -1); 
+		remove_output(); 
+		close(fd_atomic); 
+		fd_atomic= -1; 
 		return -1; 
 	}
 
@@ -259,159 +379,24 @@ pid_t Job::start(string command,
 		}
 		::signal(SIGTTIN, SIG_DFL);
 		::signal(SIGTTOU, SIG_DFL); 
-		
-		/* Set variables */ 
-		size_t v_old= 0;
-
-		map <string, size_t> old;
-		/* Index of old variables */ 
-
-		while (envp_global[v_old]) {
-			const char *p= envp_global[v_old];
-			const char *q= p;
-			while (*q && *q != '=')  ++q;
-			string key_old(p, q-p);
-			old[key_old]= v_old;
-			++v_old;
-		}
-
-		const size_t v_new= mapping.size() + 1; 
-		/* Maximal size of added variables.  The "+1" is for $STU_STATUS */ 
 
-		const char** envp= (const char **)
-			malloc(sizeof(char **) * (v_old + v_new + 1));
-		if (!envp) {
-			assert(false);
-			perror("malloc");
-			_Exit(127); 
-		}
-		memcpy(envp, envp_global, v_old * sizeof(char **)); 
-		size_t i= v_old;
-		for (auto j= mapping.begin();  j != mapping.end();  ++j) {
-			string key= j->first;
-			string value= j->second;
-			assert(key.find('=') == string::npos); 
-			size_t len_combined= key.size() + 1 + value.size() + 1;
-			char *combined= (char *)malloc(len_combined);
-			if (! combined) {
-				assert(false);
-				perror("malloc");
-				_Exit(127); 
-			}
-			if ((ssize_t)(len_combined - 1) != snprintf(combined, len_combined, "%s=%s", key.c_str(), value.c_str())) {
-				perror("snprintf");
-				_Exit(127); 
-			}
-			if (old.count(key)) {
-				size_t v_index= old.at(key);
-				envp[v_index]= combined;
-			} else {
-				assert(i < v_old + v_new); 
-				envp[i++]= combined;
-			}
-		}
-		envp[i++]= "STU_STATUS=1";
-		assert(i <= v_old + v_new);
-		envp[i]= nullptr;
-
-		/* As $0 of the process, we pass the filename of the
-		 * command followed by a colon, the line number, a colon
-		 * and the column number.  This makes the shell if it
-		 * reports an error make the most useful output.  */
-		string argv0= place_command.as_argv0();
-		if (argv0 == "")
-			argv0= shell; 
-
-		/* The one-character options to the shell */
-		/* We use the -e option ('error'), which makes the shell abort
-		 * on a command that fails.  This is also what POSIX prescribes
-		 * for Make.  It is particularly important for Stu, as Stu
-		 * invokes the whole (possibly multiline) command in one step. */
-		const char *shell_options= option_individual ? "-ex" : "-e"; 
-
-		const char *argv[]= {argv0.c_str(), 
-				     shell_options, "-c", arg, nullptr}; 
-
-		/* 
-		 * Special handling of the case when the command
-		 * starts with '-' or '+'.  In that case, we prepend
-		 * a space to the command.  We cannot use '--' as
-		 * prescribed by POSIX because Linux and FreeBSD handle
-		 * '--' differently: 
-		 *
-		 *      /bin/sh -c -- '+x' 
-		 *      on Linux: Execute the command '+x'
-		 *      on FreeBSD: Execute the command '--' and set
-		 *                  the +x option
-		 *
-		 *      /bin/sh -c +x
-		 *      on Linux: Set the +x option, and missing
-		 *                argument to -c
-		 *      on FreeBSD: Execute the command '+x'
-		 *
-		 * See:
-		 * http://stackoverflow.com/questions/37886661/handling-of-in-arguments-of-bin-sh-posix-vs-implementations-by-bash-dash 
-		 *
-		 * It seems that FreeBSD violates POSIX in this regard. 
-		 */
-
-		if (arg[0] == '-' || arg[0] == '+') {
-			command= ' ' + command;
-			arg= command.c_str();
-			argv[3]= arg;
-		}
-
-		/* Output redirection */
-		if (filename_output != "") {
-			int fd_output= creat
-				(filename_output.c_str(), 
-				 /* All +rw, i.e. 0666 */
-				 S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); 
-			if (fd_output < 0) {
-				perror(filename_output.c_str());
-				_Exit(127); 
-			}
-			assert(fd_output != 1); 
-			int r= dup2(fd_output, 1); /* 1 = file descriptor of STDOUT */ 
-			if (r < 0) {
+		if (fd_atomic >= 0) {
+			if (0 > dup2(fd_atomic, 1)) {
 				perror(filename_output.c_str());
 				_Exit(127); 
 			}
-			assert(r == 1);
-			close(fd_output); 
-		}
-
-		/* Input redirection:  from the given file, or from
-		 * /dev/null (in non-interactive mode)  */
-		if (filename_input != "" || ! option_interactive) {
-			const char *name= filename_input == ""
-				? "/dev/null"
-				: filename_input.c_str(); 
-			int fd_input= open(name, O_RDONLY); 
-			if (fd_input < 0) {
-				perror(name);
-				_Exit(127); 
-			}
-			assert(fd_input >= 3); 
-			int r= dup2(fd_input, 0); /* 0 = file descriptor of STDIN */  
-			if (r < 0) {
-				perror(name);
-				_Exit(127); 
-			}
-			assert(r == 0); 
-			if (close(fd_input) < 0) {
-				perror(name); 
-				_Exit(127); 
-			}
+			close(fd_atomic); 
+			filename_output= ""; 
 		}
+		
+		if (stream != nullptr) 
+			exec_stream(shell, command, mapping, variables, 
+				    filename_output, place_command, *stream); 
 
-		int r= execve(shell, (char *const *) argv, (char *const *) envp); 
-
-		/* If execve() returns, there is an error, and its return value is -1 */
-		assert(r == -1); 
-		perror("execve");
-		_Exit(127); 
-	} 
+		redirect_output(filename_output); 
+		redirect_input(filename_input); 
+		exec_command(shell, command, mapping, variables, place_command); 
+	}
 
 	/* Here, we are the parent process */
 
@@ -429,6 +414,363 @@ pid_t Job::start(string command,
 	return pid; 
 }
 
+void Job::exec_command(const char *shell,
+		       string command,
+		       const map <string, string> &mapping,
+		       const Variables &variables,
+		       const Place &place_command)
+{
+	const char *arg= command.c_str(); 
+	/* c_str() never returns nullptr, as by the standard */ 
+	assert(arg != nullptr);
+
+	/* Set variables */ 
+	size_t v_old= 0;
+
+	map <string, size_t> old;
+	/* Index of old variables */ 
+
+	while (envp_global[v_old]) {
+		const char *p= envp_global[v_old];
+		const char *q= p;
+		while (*q && *q != '=')  ++q;
+		string key_old(p, q-p);
+		old[key_old]= v_old;
+		++v_old;
+	}
+
+	const size_t v_new= mapping.size() + variables.size() + 1; 
+	/* Maximal size of added variables.  The "+1" is for $STU_STATUS */ 
+
+	const char** envp= (const char **)
+		malloc(sizeof(char **) * (v_old + v_new + 1));
+	if (!envp) {
+		assert(false);
+		perror("malloc");
+		_Exit(127); 
+	}
+	memcpy(envp, envp_global, v_old * sizeof(char **)); 
+	size_t i= v_old;
+	for (auto j= variables.begin();  j != variables.end();  ++j) {
+		const string &key= j->first;
+		char *combined= combine(key, *j->second); 
+		if (old.count(key)) {
+			size_t v_index= old.at(key);
+			envp[v_index]= combined;
+		} else {
+			assert(i < v_old + v_new); 
+			envp[i++]= combined;
+		}
+	}
+	for (auto j= mapping.begin();  j != mapping.end();  ++j) {
+		const string &key= j->first;
+		if (variables.count(key))
+			continue;
+		char *combined= combine(key, j->second); 
+		if (old.count(key)) {
+			size_t v_index= old.at(key);
+			envp[v_index]= combined;
+		} else {
+			assert(i < v_old + v_new); 
+			envp[i++]= combined;
+		}
+	}
+	envp[i++]= "STU_STATUS=1";
+	assert(i <= v_old + v_new);
+	envp[i]= nullptr;
+
+	/* As $0 of the process, we pass the filename of the
+	 * command followed by a colon, the line number, a colon
+	 * and the column number.  This makes the shell if it
+	 * reports an error make the most useful output.  */
+	string argv0= place_command.as_argv0();
+	if (argv0 == "")
+		argv0= shell; 
+
+	/* The one-character options to the shell */
+	/* We use the -e option ('error'), which makes the shell abort
+	 * on a command that fails.  This is also what POSIX prescribes
+	 * for Make.  It is particularly important for Stu, as Stu
+	 * invokes the whole (possibly multiline) command in one step. */
+	const char *shell_options= option_individual ? "-ex" : "-e"; 
+
+	const char *argv[]= {argv0.c_str(), 
+			     shell_options, "-c", arg, nullptr}; 
+
+	/* 
+	 * Special handling of the case when the command
+	 * starts with '-' or '+'.  In that case, we prepend
+	 * a space to the command.  We cannot use '--' as
+	 * prescribed by POSIX because Linux and FreeBSD handle
+	 * '--' differently: 
+	 *
+	 *      /bin/sh -c -- '+x' 
+	 *      on Linux: Execute the command '+x'
+	 *      on FreeBSD: Execute the command '--' and set
+	 *                  the +x option
+	 *
+	 *      /bin/sh -c +x
+	 *      on Linux: Set the +x option, and missing
+	 *                argument to -c
+	 *      on FreeBSD: Execute the command '+x'
+	 *
+	 * See:
+	 * http://stackoverflow.com/questions/37886661/handling-of-in-arguments-of-bin-sh-posix-vs-implementations-by-bash-dash 
+	 *
+	 * It seems that FreeBSD violates POSIX in this regard. 
+	 */
+
+	if (arg[0] == '-' || arg[0] == '+') {
+		command= ' ' + command;
+		arg= command.c_str();
+		argv[3]= arg;
+	}
+
+	int r= execve(shell, (char *const *) argv, (char *const *) envp); 
+
+	/* If execve() returns, there is an error, and its return value is -1 */
+	assert(r == -1); 
+	perror("execve");
+	_Exit(127);
+}
+
+char *Job::combine(const string &key, const string &value)
+{
+	assert(key.find('=') == string::npos); 
+	size_t len_combined= key.size() + 1 + value.size() + 1;
+	char *combined= (char *)malloc(len_combined);
+	if (! combined) {
+		assert(false);
+		perror("malloc");
+		_Exit(127); 
+	}
+	memcpy(combined, key.c_str(), key.size()); 
+	combined[key.size()]= '='; 
+	memcpy(combined + key.size() + 1, value.c_str(), value.size() + 1); 
+	return combined; 
+}
+
+bool Job::check_environment(const string &command, 
+			    const map <string, string> &mapping,
+			    const Variables &variables,
+			    const Place &place_command)
+{
+	/* The total size of arguments and environment, including
+	 * pointers  */ 
+	long arg_max= sysconf(_SC_ARG_MAX); 
+	size_t size_max= arg_max > 0 ? arg_max : SIZE_MAX; 
+
+	/* Linux additionally limits the size of each single string to
+	 * MAX_ARG_STRLEN, i.e., 32 pages */ 
+	size_t size_max_string= SIZE_MAX;
+#ifdef __linux__
+	long page_size= sysconf(_SC_PAGESIZE); 
+	if (page_size > 0) 
+		size_max_string= 32 * page_size; 
+#endif
+
+	/* The arguments passed by exec_command(), with some room for the
+	 * shell options, and the inherited environment */ 
+	size_t size= place_command.as_argv0().size() + 1 + 
+		command.size() + 1 + 16 + 5 * sizeof(char *); 
+	for (const char *const *p= envp_global;  *p;  ++p) 
+		size += strlen(*p) + 1 + sizeof(char *); 
+
+	for (auto j= mapping.begin();  j != mapping.end();  ++j) {
+		if (variables.count(j->first))
+			continue;
+		size += j->first.size() + 1 + j->second.size() + 1 + sizeof(char *); 
+	}
+	for (auto j= variables.begin();  j != variables.end();  ++j) {
+		size_t size_string= j->first.size() + 1 + j->second->size() + 1; 
+		if (size_string > size_max_string) {
+			place_command << 
+				fmt("variable %s is too large to be passed to the command (%s bytes, the maximum is %s)",
+				    prefix_format_word(j->first, "$"), 
+				    frmt("%zu", j->second->size()),
+				    frmt("%zu", size_max_string - j->first.size() - 2)); 
+			return false; 
+		}
+		size += size_string + sizeof(char *); 
+	}
+
+	if (size > size_max) {
+		place_command << 
+			fmt("environment of the command is too large (%s bytes, the maximum is %s)",
+			    frmt("%zu", size), 
+			    frmt("%zu", size_max)); 
+		return false; 
+	}
+
+	return true; 
+}
+
+void Job::redirect_output(const string &filename_output)
+{
+	/* Output redirection */
+	if (filename_output != "") {
+		int fd_output= creat
+			(filename_output.c_str(), 
+			 /* All +rw, i.e. 0666 */
+			 S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); 
+		if (fd_output < 0) {
+			perror(filename_output.c_str());
+			_Exit(127); 
+		}
+		assert(fd_output != 1); 
+		int r= dup2(fd_output, 1); /* 1 = file descriptor of STDOUT */ 
+		if (r < 0) {
+			perror(filename_output.c_str());
+			_Exit(127); 
+		}
+		assert(r == 1);
+		close(fd_output); 
+	}
+}
+
+void Job::redirect_input(const string &filename_input)
+{
+	/* Input redirection:  from the given file, or from
+	 * /dev/null (in non-interactive mode)  */
+	if (filename_input != "" || ! option_interactive) {
+		const char *name= filename_input == ""
+			? "/dev/null"
+			: filename_input.c_str(); 
+		int fd_input= open(name, O_RDONLY); 
+		if (fd_input < 0) {
+			perror(name);
+			_Exit(127); 
+		}
+		assert(fd_input >= 3); 
+		int r= dup2(fd_input, 0); /* 0 = file descriptor of STDIN */  
+		if (r < 0) {
+			perror(name);
+			_Exit(127); 
+		}
+		assert(r == 0); 
+		if (close(fd_input) < 0) {
+			perror(name); 
+			_Exit(127); 
+		}
+	}
+}
+
+void Job::exec_stream(const char *shell,
+		      string command,
+		      const map <string, string> &mapping,
+		      const Variables &variables,
+		      const string &filename_output,
+		      const Place &place_command,
+		      const Stream &stream)
+/* This process waits for both commands, and terminates in the same way
+ * as the command, or as the producer when only the producer failed.  */
+{
+	int fd_pipe[2];
+	if (0 > pipe(fd_pipe)) {
+		perror("pipe");
+		_Exit(127); 
+	}
+
+	/* The producer, writing into the pipe */ 
+	pid_t pid_stream= fork();
+	if (pid_stream < 0) {
+		perror("fork");
+		_Exit(127); 
+	}
+	if (pid_stream == 0) {
+		if (0 > dup2(fd_pipe[1], 1)) {
+			perror("dup2");
+			_Exit(127); 
+		}
+		close(fd_pipe[0]);
+		close(fd_pipe[1]); 
+		redirect_input(""); 
+		exec_command(shell, stream.command, stream.mapping, 
+			     stream.variables, stream.place); 
+	}
+
+	/* The command, reading from the pipe */ 
+	pid_t pid_command= fork();
+	if (pid_command < 0) {
+		perror("fork");
+		_Exit(127); 
+	}
+	if (pid_command == 0) {
+		if (0 > dup2(fd_pipe[0], 0)) {
+			perror("dup2");
+			_Exit(127); 
+		}
+		close(fd_pipe[0]);
+		close(fd_pipe[1]); 
+		redirect_output(filename_output); 
+		exec_command(shell, command, mapping, variables, place_command); 
+	}
+
+	close(fd_pipe[0]);
+	close(fd_pipe[1]); 
+
+	int status_stream= 0, status_command= 0;
+	for (int count= 0;  count < 2;) {
+		int status;
+		pid_t pid_waited= waitpid(-1, &status, 0);
+		if (pid_waited < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid");
+			_Exit(127); 
+		}
+		if (pid_waited == pid_stream) {
+			status_stream= status;
+			++count;
+		} else if (pid_waited == pid_command) {
+			status_command= status;
+			++count; 
+		}
+	}
+
+	/* When the command does not read all its input, the producer
+	 * receives SIGPIPE, which is not an error.  The shell reports
+	 * this as exit status 128 + SIGPIPE when the signal was received
+	 * by one of its children.  */
+	int status= status_command;
+	if (status_command == 0 && status_stream != 0 &&
+	    ! (WIFSIGNALED(status_stream) && WTERMSIG(status_stream) == SIGPIPE) &&
+	    ! (WIFEXITED(status_stream) && WEXITSTATUS(status_stream) == 128 + SIGPIPE)) {
+		stream.place << fmt("command for %s %s", 
+				    name_format_word(stream.filename), 
+				    format_status(status_stream)); 
+		status= status_stream; 
+	}
+
+	if (WIFSIGNALED(status)) {
+		::signal(WTERMSIG(status), SIG_DFL); 
+		raise(WTERMSIG(status)); 
+	}
+	_Exit(WIFEXITED(status) ? WEXITSTATUS(status) : 127); 
+}
+
+string Job::format_status(int status)
+{
+	if (WIFEXITED(status)) {
+		return frmt("failed with exit status %s%d%s", 
+			    Color::word,
+			    WEXITSTATUS(status),
+			    Color::end);
+	} else if (WIFSIGNALED(status)) {
+		int sig= WTERMSIG(status);
+		return frmt("received signal %d (%s)", 
+			    sig,
+			    strsignal(sig));
+	} else {
+		/* This should not happen but the standard does not exclude
+		 * it  */ 
+		return frmt("failed with status %s%d%s",
+			    Color::word,
+			    status,
+			    Color::end); 
+	}
+}
+
 /* This function works analogously to start() with respect to invocation
  * of fork() and other system-related functions.  */
 pid_t Job::start_copy(string target,
@@ -491,7 +833,7 @@ pid_t Job::start_copy(string target,
 }
 
 
-pid_t Job::wait(int *status)
+pid_t Job::wait(int *status, int timeout)
 /* The main loop of Stu.  We wait for the two productive signals SIGCHLD
  * and SIGUSR1.  When this function is called, there is always at least
  * one child process running.  */
@@ -557,6 +899,9 @@ pid_t Job::wait(int *status)
 
 	int sig;
 	int r;
+#if ! HAVE_SIGTIMEDWAIT
+	(void) timeout;
+#endif
 
  retry:
 	{
@@ -571,6 +916,17 @@ pid_t Job::wait(int *status)
 		 * portable.  */
 		Signal_Blocker signal_blocker; 
 		errno= 0;
+#if HAVE_SIGTIMEDWAIT
+		if (timeout >= 0) {
+			struct timespec t;
+			t.tv_sec= timeout / 1000;
+			t.tv_nsec= (long) (timeout % 1000) * 1000000;
+			sig= sigtimedwait(&set_termination_productive, nullptr, &t);
+			if (sig < 0 && errno == EAGAIN)
+				return 0;
+			r= sig < 0 ? -1 : 0;
+		} else
+#endif
 		r= sigwait(&set_termination_productive, &sig);
 	}
 
@@ -641,9 +997,84 @@ bool Job::waited(int status, pid_t pid_check)
 	}
 	
 	pid= -1;
+
+	if (! success && fd_atomic >= 0) {
+		remove_output(); 
+		close(fd_atomic); 
+		fd_atomic= -1; 
+	}
+
 	return success; 
 }
 
+bool Job::commit_output()
+{
+	assert(pid == -1); 
+	if (fd_atomic < 0)
+		return true;
+
+	bool ret= link_atomic(fd_atomic, filename_tmp, filename_atomic); 
+	int errno_save= errno; 
+	if (! ret)
+		remove_output(); 
+	close(fd_atomic); 
+	fd_atomic= -1; 
+	errno= errno_save; 
+	return ret; 
+}
+
+void Job::remove_output()
+{
+	if (fd_atomic >= 0 && ! filename_tmp.empty())
+		unlink(filename_tmp.c_str()); 
+}
+
+int Job::open_atomic(const string &filename, string &filename_tmp)
+{
+	filename_tmp= ""; 
+
+#ifdef O_TMPFILE
+	/* The anonymous file is later given a name through /proc */ 
+	static int has_proc= -1;
+	if (has_proc < 0)
+		has_proc= access("/proc/self/fd", F_OK) == 0; 
+	if (has_proc) {
+		size_t i= filename.rfind('/'); 
+		string dir= i == string::npos ? "." : 
+			i == 0 ? "/" : filename.substr(0, i); 
+		int fd= open(dir.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 
+			     /* All +rw, i.e. 0666 */
+			     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); 
+		if (fd >= 0)
+			return fd;
+		/* Not supported by the file system:  use a name */ 
+	}
+#endif /* O_TMPFILE */ 
+
+	static unsigned count= 0; 
+	filename_tmp= filename + frmt(".stu-%ld-%u", (long) getpid(), count++); 
+	return open(filename_tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+		    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); 
+}
+
+bool Job::link_atomic(int fd, string &filename_tmp, const string &filename)
+{
+	if (filename_tmp.empty()) {
+		/* Anonymous file:  link it under a temporary name first,
+		 * as linkat() does not replace an existing file */ 
+		static unsigned count= 0; 
+		filename_tmp= filename + frmt(".stu-%ld-l%u", (long) getpid(), count++); 
+		string path= frmt("/proc/self/fd/%d", fd); 
+		if (0 > linkat(AT_FDCWD, path.c_str(), AT_FDCWD, filename_tmp.c_str(), 
+			       AT_SYMLINK_FOLLOW)) {
+			filename_tmp= ""; 
+			return false; 
+		}
+	}
+
+	return 0 == rename(filename_tmp.c_str(), filename.c_str()); 
+}
+
 void Job::print_statistics(bool allow_unterminated_jobs)
 {
 	/* Avoid double writing in case the destructor gets still called */ 
@@ -678,6 +1109,8 @@ void Job::print_statistics(bool allow_unterminated_jobs)
 	       (intmax_t) usage.ru_stime.tv_sec,
 	       (long)     usage.ru_stime.tv_usec); 
 	printf("STATISTICS  Note: children execution times exclude running jobs\n"); 
+	printf("STATISTICS  number of unchanged content files not rewritten = %zu\n",
+	       count_content_unchanged); 
 }
 
 void Job::handler_termination(int sig)
@@ -0,0 +1,909 @@
+#ifndef JOURNAL_HH
+#define JOURNAL_HH
+
+/*
+ * The change journal, used to avoid calling stat() on files that have
+ * not changed since the previous invocation of Stu.  A long-running
+ * process started with -R JOURNAL watches the current directory tree
+ * using inotify, and appends the name of each file that changes to the
+ * file JOURNAL.  Invocations of Stu with -L JOURNAL save the results of
+ * stat() in the snapshot file JOURNAL.stat, and take the results for
+ * all files that were not reported as changed since from the snapshot,
+ * instead of calling stat().
+ *
+ * The journal consists of a header line, followed by one line per
+ * change:
+ *
+ *     stu-journal-1 ID CWD   Header; ID identifies the watcher process
+ *     NAME                   The file NAME was changed
+ *     NAME/                  All files below the directory NAME were changed
+ *     !                      Changes were lost; all files were changed
+ *     :NAME                  The synchronization file NAME was created
+ *
+ * The watcher holds a lock on the journal while it is running.  To
+ * make sure that all changes made before it was started are in the
+ * journal, Stu creates a synchronization file and waits until the
+ * watcher has reported it.  When the journal does not exist, when no
+ * watcher is running, when the watcher does not answer in time, or
+ * when the snapshot belongs to another journal, all files are checked
+ * with stat() as usual.  Results are only taken from the snapshot until
+ * Stu starts a job or writes a content file.
+ *
+ * Only files within the current directory that are not reached through
+ * symbolic links are saved in the snapshot.  When the journal grows too
+ * large, the watcher starts a new one, which invalidates all snapshots.
+ * The format of the snapshot file is binary and specific to the
+ * machine.
+ */
+
+#ifndef HAVE_INOTIFY
+#   ifdef __linux__
+#      define HAVE_INOTIFY 1
+#   else
+#      define HAVE_INOTIFY 0
+#   endif
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if HAVE_INOTIFY
+#   include <sys/inotify.h>
+#endif
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "prefetch.hh"
+
+class Change_Journal
+{
+public:
+	static void record(const char *filename_journal);
+	/* Watch the current directory and write changes to the given
+	 * journal.  Does not return.  Called when the -R option is
+	 * processed.  */
+
+	static void load(const char *filename_journal);
+	/* Read the given journal and its snapshot.  Called when the -L
+	 * option is processed.  */
+
+	static void reload() {
+		if (! filename.empty())
+			load(filename.c_str());
+	}
+	/* Read the journal again, if one was loaded.  Used by the
+	 * server mode before each request.  */
+
+	static bool enabled() {  return valid;  }
+
+	static bool known(const char *filename) {
+		return valid && ! is_modified && entries.count(filename);
+	}
+	/* Whether stat() on FILENAME will be answered from the snapshot */
+
+	static int stat(const char *filename, struct stat *buf);
+	/* Like stat(2), including the setting of ERRNO.  Falls back to
+	 * Stat_Prefetch::stat().  */
+
+	static void modified() {  is_modified= true;  }
+	/* Called when Stu may modify files, i.e., before a job is
+	 * started or a file with content is written */
+
+	static void save();
+	/* Write back the snapshot if it was changed */
+
+	/* The following functions are used by the watch mode, in which
+	 * the entries are kept in memory by the watching process
+	 * instead of in a snapshot file */
+
+	static void init_memory() {  valid= true;  }
+	/* Use the entries in memory without a journal */
+
+	static void set_output(int fd) {  fd_output= fd;  }
+	/* Write the entries to FD in save(), instead of to the snapshot
+	 * file */
+
+	static void read_entries(int fd);
+	/* Replace the entries by those written to FD by save() in
+	 * another process, if any.  Reads until the end of the file.  */
+
+	static bool invalidate(const string &line);
+	/* Remove the entries affected by LINE, which has the syntax of
+	 * a line of the journal.  A file is only removed when stat()
+	 * does not give the saved result anymore.  Return whether
+	 * entries were removed.  */
+
+	static void created(const char *filename) {
+		if (fd_output >= 0)
+			names_created.insert(filename);
+	}
+	/* Called before Stu creates the file FILENAME.  Such files are
+	 * checked again in save().  */
+
+#if HAVE_INOTIFY
+	static void watch_tree(int fd_inotify,
+			       unordered_map <int, string> &watches,
+			       const string &dir);
+	/* Watch the directory DIR and all directories below it, without
+	 * following symbolic links.  DIR is empty or ends in a slash.
+	 * WATCHES contains the directory names ending in a slash, or ""
+	 * for the current directory, by watch descriptor.  */
+
+	static void read_events(int fd_inotify,
+				unordered_map <int, string> &watches,
+				vector <string> &lines);
+	/* Read events and append the corresponding lines of the
+	 * journal to LINES.  Returns without lines when FD_INOTIFY is
+	 * non-blocking and no event is available.  */
+#endif
+
+private:
+	struct Entry {
+		uint64_t exists, mode, size, mtime_sec, mtime_nsec;
+	};
+
+	static const uint64_t JOURNAL_MAX= 1 << 26;
+	/* Size in bytes above which the watcher starts a new journal */
+
+	static const int SYNC_TIMEOUT_MS= 1000;
+	/* Maximal time to wait for the watcher to report the
+	 * synchronization file */
+
+	static string filename;
+	/* The journal */
+
+	static string id;
+	/* Identifier of the watcher, from the header of the journal */
+
+	static bool valid;
+	/* Whether the journal and the watcher are usable */
+
+	static bool is_modified;
+
+	static bool changed;
+	/* Whether ENTRIES must be written back */
+
+	static uint64_t offset;
+	/* The position in the journal up to which all changes are
+	 * reflected in ENTRIES */
+
+	static unordered_map <string, Entry> entries;
+	/* By filename */
+
+	static unordered_map <string, bool> dirs_recordable;
+	/* For directory names ending in a slash, whether files in them
+	 * can be saved in the snapshot.  Only for this invocation.  */
+
+	static int fd_output;
+	/* Set by set_output(), or -1 */
+
+	static unordered_set <string> names_created;
+
+	static bool read_header(int fd, string &id_header, string &cwd, uint64_t &size);
+	static bool synchronize(int fd, uint64_t offset_begin, uint64_t &offset_sync);
+	static uint64_t read_snapshot(uint64_t offset_begin, uint64_t offset_sync);
+	static bool parse_entries(const string &in, string &id_snapshot,
+				  uint64_t &offset_snapshot);
+	static void apply(const string &lines);
+	static void get_entry(int ret, const struct stat *buf, Entry &entry);
+	static bool is_recordable(const char *filename);
+	static string get_cwd();
+	static bool write_all(int fd, const string &out);
+
+#if HAVE_INOTIFY
+	static int start(const string &cwd);
+#endif
+
+	static void write_u64(string &out, uint64_t x) {
+		out.append((const char *) &x, sizeof(x));
+	}
+	static bool read_u64(const char *&p, const char *p_end, uint64_t &x);
+	static bool read_string(const char *&p, const char *p_end, string &s);
+};
+
+const char CHANGE_JOURNAL_MAGIC[]= "stu-journal-1 ";
+const char CHANGE_JOURNAL_SNAPSHOT_MAGIC[]= "stu-journal-snapshot-1\n";
+const char CHANGE_JOURNAL_SYNC_PREFIX[]= ".stu-journal-sync.";
+
+string Change_Journal::filename;
+string Change_Journal::id;
+bool Change_Journal::valid= false;
+bool Change_Journal::is_modified= false;
+bool Change_Journal::changed= false;
+uint64_t Change_Journal::offset= 0;
+unordered_map <string, Change_Journal::Entry> Change_Journal::entries;
+unordered_map <string, bool> Change_Journal::dirs_recordable;
+int Change_Journal::fd_output= -1;
+unordered_set <string> Change_Journal::names_created;
+
+void Change_Journal::record(const char *filename_journal)
+{
+#if HAVE_INOTIFY
+	assert(filename_journal != nullptr && *filename_journal != '\0');
+	filename= filename_journal;
+	const string cwd= get_cwd();
+
+	/* The watcher must not report its own writes to the journal,
+	 * nor those to the snapshot */
+	string name_journal= Name::canonical(filename_journal);
+	if (name_journal.size() > cwd.size() &&
+	    name_journal.compare(0, cwd.size(), cwd) == 0 &&
+	    name_journal[cwd.size()] == '/')
+		name_journal= name_journal.substr(cwd.size() + 1);
+	const string prefix_journal= name_journal + '.';
+
+	/* Refuse to run when another watcher is running */
+	int fd_old= open(filename_journal, O_RDONLY | O_CLOEXEC);
+	if (fd_old >= 0) {
+		string id_old, cwd_old;
+		uint64_t size_old;
+		bool running= read_header(fd_old, id_old, cwd_old, size_old);
+		close(fd_old);
+		if (running) {
+			print_error(fmt("Journal %s is already used by another watcher",
+					name_format_word(filename_journal)));
+			exit(ERROR_FATAL);
+		}
+	}
+
+	int fd_inotify= inotify_init1(IN_CLOEXEC);
+	if (fd_inotify < 0) {
+		print_error_system("inotify_init1");
+		exit(ERROR_FATAL);
+	}
+	unordered_map <int, string> watches;
+	/* Directory names ending in a slash, or "" for the current
+	 * directory, by watch descriptor */
+	watch_tree(fd_inotify, watches, "");
+	int fd= start(cwd);
+	uint64_t size= lseek(fd, 0, SEEK_END);
+
+	string line_last;
+	/* The last line written, to avoid writing a file repeatedly
+	 * while it is being written to */
+	for (;;) {
+		vector <string> lines;
+		read_events(fd_inotify, watches, lines);
+
+		string out;
+		unordered_set <string> lines_out;
+		for (const string &line:  lines) {
+			/* The watcher must not report its own writes */
+			string name= line;
+			if (name.back() == '/')
+				name.pop_back();
+			if (name == name_journal ||
+			    name.compare(0, prefix_journal.size(), prefix_journal) == 0)
+				continue;
+			if (line != line_last && lines_out.insert(line).second) {
+				out += line;
+				out += '\n';
+				line_last= line;
+			}
+		}
+
+		if (! write_all(fd, out)) {
+			print_error_system(filename);
+			exit(ERROR_FATAL);
+		}
+		size += out.size();
+		if (size > JOURNAL_MAX) {
+			close(fd);
+			fd= start(cwd);
+			size= lseek(fd, 0, SEEK_END);
+		}
+	}
+#else /* ! HAVE_INOTIFY */
+	(void) filename_journal;
+	Place(Place::Type::OPTION, 'R') <<
+		"watching files is not supported on this platform";
+	exit(ERROR_FATAL);
+#endif /* ! HAVE_INOTIFY */
+}
+
+void Change_Journal::load(const char *filename_journal)
+{
+	assert(filename_journal != nullptr && *filename_journal != '\0');
+	filename= filename_journal;
+	valid= false;
+	entries.clear();
+
+	/* All errors lead to all files being checked with stat() */
+	int fd= open(filename_journal, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	string cwd;
+	uint64_t offset_begin, offset_sync;
+	if (! read_header(fd, id, cwd, offset_begin) ||
+	    cwd != get_cwd() ||
+	    ! synchronize(fd, offset_begin, offset_sync)) {
+		close(fd);
+		return;
+	}
+
+	uint64_t offset_snapshot= read_snapshot(offset_begin, offset_sync);
+	string lines;
+	lines.resize(offset_sync - offset_snapshot);
+	ssize_t r= pread(fd, &lines[0], lines.size(), offset_snapshot);
+	close(fd);
+	if (r != (ssize_t) lines.size()) {
+		entries.clear();
+		return;
+	}
+	apply(lines);
+	offset= offset_sync;
+	valid= true;
+}
+
+int Change_Journal::stat(const char *filename_stat, struct stat *buf)
+{
+	if (! valid)
+		return Stat_Prefetch::stat(filename_stat, buf);
+
+	if (! is_modified) {
+		auto i= entries.find(filename_stat);
+		if (i != entries.end()) {
+			const Entry &entry= i->second;
+			if (! entry.exists) {
+				errno= ENOENT;
+				return -1;
+			}
+			memset(buf, 0, sizeof(*buf));
+			buf->st_mode= entry.mode;
+			buf->st_size= entry.size;
+			buf->st_mtime= entry.mtime_sec;
+#if USE_MTIM
+			buf->st_mtim.tv_nsec= entry.mtime_nsec;
+#endif
+			return 0;
+		}
+	}
+
+	int ret= Stat_Prefetch::stat(filename_stat, buf);
+	int errno_stat= errno;
+	if ((ret == 0 || errno_stat == ENOENT) && is_recordable(filename_stat)) {
+		Entry entry;
+		get_entry(ret, buf, entry);
+		Entry &entry_old= entries[filename_stat];
+		if (memcmp(&entry_old, &entry, sizeof(entry))) {
+			entry_old= entry;
+			changed= true;
+		}
+	}
+	errno= errno_stat;
+	return ret;
+}
+
+void Change_Journal::save()
+{
+	if (! valid)
+		return;
+
+	/* Created files are saved with their new state */
+	for (const string &name:  names_created) {
+		entries.erase(name);
+		changed= true;
+		struct stat buf;
+		stat(name.c_str(), &buf);
+	}
+	names_created.clear();
+
+	if (! changed)
+		return;
+
+	string out= CHANGE_JOURNAL_SNAPSHOT_MAGIC;
+	write_u64(out, id.size());
+	out += id;
+	write_u64(out, offset);
+	for (const auto &i:  entries) {
+		write_u64(out, i.first.size());
+		out += i.first;
+		out.append((const char *) &i.second, sizeof(i.second));
+	}
+
+	if (fd_output >= 0) {
+		/* Errors are detected by the reader */
+		write_all(fd_output, out);
+		close(fd_output);
+		fd_output= -1;
+		changed= false;
+		return;
+	}
+
+	/* Several invocations of Stu may use the same journal at the
+	 * same time */
+	string filename_snapshot= filename + ".stat";
+	string filename_tmp= filename_snapshot + frmt(".%ld", (long) getpid());
+	int fd= creat(filename_tmp.c_str(), 0666);
+	if (fd < 0)
+		goto error;
+	if (! write_all(fd, out)) {
+		close(fd);
+		goto error;
+	}
+	if (close(fd) < 0 ||
+	    rename(filename_tmp.c_str(), filename_snapshot.c_str()) < 0)
+		goto error;
+	changed= false;
+	return;
+
+ error:
+	print_error_system(filename_tmp);
+	unlink(filename_tmp.c_str());
+	exit(ERROR_FATAL);
+}
+
+bool Change_Journal::read_header(int fd, string &id_header, string &cwd, uint64_t &size)
+/* Return whether the journal is valid and its watcher is running.  SIZE
+ * is set to the size of the header.  */
+{
+	/* The watcher holds a write lock on the whole file */
+	struct flock lock;
+	lock.l_type= F_RDLCK;
+	lock.l_whence= SEEK_SET;
+	lock.l_start= 0;
+	lock.l_len= 0;
+	if (fcntl(fd, F_GETLK, &lock) < 0 || lock.l_type == F_UNLCK)
+		return false;
+
+	char b[PATH_MAX + 256];
+	ssize_t r= pread(fd, b, sizeof(b), 0);
+	if (r <= 0)
+		return false;
+	const char *end= (const char *) memchr(b, '\n', r);
+	const size_t len_magic= sizeof(CHANGE_JOURNAL_MAGIC) - 1;
+	if (end == nullptr || (size_t)(end - b) < len_magic ||
+	    memcmp(b, CHANGE_JOURNAL_MAGIC, len_magic))
+		return false;
+	const char *p= b + len_magic;
+	const char *space= (const char *) memchr(p, ' ', end - p);
+	if (space == nullptr)
+		return false;
+	id_header= string(p, space - p);
+	cwd= string(space + 1, end - (space + 1));
+	size= end + 1 - b;
+	return true;
+}
+
+bool Change_Journal::synchronize(int fd, uint64_t offset_begin, uint64_t &offset_sync)
+/* Create a synchronization file and wait until it appears in the
+ * journal.  Set OFFSET_SYNC to the end of its line.  */
+{
+	struct stat buf;
+	if (fstat(fd, &buf) < 0 || (uint64_t) buf.st_size < offset_begin)
+		return false;
+	const uint64_t offset_read= buf.st_size;
+
+	const string name_sync= frmt("%s%ld", CHANGE_JOURNAL_SYNC_PREFIX, (long) getpid());
+	const string line_sync= ':' + name_sync + '\n';
+	int fd_sync= open(name_sync.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd_sync < 0)
+		return false;
+	close(fd_sync);
+
+	bool found= false;
+	string in;
+	for (int i= 0;  i < SYNC_TIMEOUT_MS && ! found;  ++i) {
+		char b[1 << 12];
+		ssize_t r;
+		while ((r= pread(fd, b, sizeof(b), offset_read + in.size())) > 0)
+			in.append(b, r);
+		for (size_t k= in.find(line_sync);  k != string::npos;
+		     k= in.find(line_sync, k + 1)) {
+			if (k == 0 || in[k - 1] == '\n') {
+				offset_sync= offset_read + k + line_sync.size();
+				found= true;
+				break;
+			}
+		}
+		if (! found) {
+			struct timespec t= {0, 1000 * 1000};
+			nanosleep(&t, nullptr);
+		}
+	}
+	unlink(name_sync.c_str());
+	return found;
+}
+
+uint64_t Change_Journal::read_snapshot(uint64_t offset_begin, uint64_t offset_sync)
+/* Read the snapshot into ENTRIES, and return the position in the
+ * journal up to which it reflects the changes.  When there is no
+ * usable snapshot, ENTRIES is empty and OFFSET_BEGIN is returned.  */
+{
+	changed= true;
+
+	int fd= open((filename + ".stat").c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return offset_begin;
+	string in;
+	char b[1 << 16];
+	ssize_t r;
+	while ((r= read(fd, b, sizeof(b))) > 0)
+		in.append(b, r);
+	close(fd);
+	if (r < 0)
+		return offset_begin;
+
+	string id_snapshot;
+	uint64_t offset_snapshot;
+	if (! parse_entries(in, id_snapshot, offset_snapshot) ||
+	    id_snapshot != id ||
+	    offset_snapshot < offset_begin || offset_snapshot > offset_sync) {
+		entries.clear();
+		return offset_begin;
+	}
+	changed= false;
+	return offset_snapshot;
+}
+
+bool Change_Journal::parse_entries(const string &in, string &id_snapshot,
+				   uint64_t &offset_snapshot)
+/* Parse a snapshot into ENTRIES.  On errors, return false and leave
+ * ENTRIES empty.  */
+{
+	entries.clear();
+	const char *p= in.c_str(), *const p_end= p + in.size();
+	const size_t len_magic= sizeof(CHANGE_JOURNAL_SNAPSHOT_MAGIC) - 1;
+	if (in.size() < len_magic || memcmp(p, CHANGE_JOURNAL_SNAPSHOT_MAGIC, len_magic))
+		return false;
+	p += len_magic;
+	if (! read_string(p, p_end, id_snapshot) ||
+	    ! read_u64(p, p_end, offset_snapshot))
+		return false;
+	while (p < p_end) {
+		string name;
+		Entry entry;
+		if (! read_string(p, p_end, name) ||
+		    (size_t)(p_end - p) < sizeof(entry)) {
+			entries.clear();
+			return false;
+		}
+		memcpy(&entry, p, sizeof(entry));
+		p += sizeof(entry);
+		entries[name]= entry;
+	}
+	return true;
+}
+
+void Change_Journal::read_entries(int fd)
+{
+	string in;
+	char b[1 << 16];
+	ssize_t r;
+	while ((r= read(fd, b, sizeof(b))) != 0) {
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		in.append(b, r);
+	}
+	if (r < 0) {
+		entries.clear();
+		return;
+	}
+	if (in.empty())
+		return;
+	string id_snapshot;
+	uint64_t offset_snapshot;
+	parse_entries(in, id_snapshot, offset_snapshot);
+}
+
+bool Change_Journal::invalidate(const string &line)
+{
+	if (line.empty() || line[0] == ':')
+		return false;
+
+	if (line == "!") {
+		bool ret= ! entries.empty();
+		entries.clear();
+		return ret;
+	}
+
+	if (line.back() == '/') {
+		bool ret= false;
+		for (auto i= entries.begin();  i != entries.end();) {
+			if (i->first.compare(0, line.size(), line) == 0) {
+				i= entries.erase(i);
+				ret= true;
+			} else {
+				++i;
+			}
+		}
+		return ret;
+	}
+
+	auto i= entries.find(line);
+	if (i == entries.end())
+		return false;
+	struct stat buf;
+	Entry entry;
+	get_entry(::stat(line.c_str(), &buf), &buf, entry);
+	if (! memcmp(&entry, &i->second, sizeof(entry)))
+		return false;
+	entries.erase(i);
+	return true;
+}
+
+void Change_Journal::apply(const string &lines)
+/* Remove all changed files from ENTRIES */
+{
+	unordered_set <string> prefixes;
+	for (size_t k= 0;  k < lines.size();) {
+		size_t end= lines.find('\n', k);
+		if (end == string::npos)
+			break;
+		string line= lines.substr(k, end - k);
+		k= end + 1;
+		if (line.empty() || line[0] == ':')
+			continue;
+		if (line == "!") {
+			entries.clear();
+			changed= true;
+			return;
+		}
+		if (line.back() == '/')
+			prefixes.insert(line);
+		else if (entries.erase(line))
+			changed= true;
+	}
+	if (prefixes.empty())
+		return;
+	for (auto i= entries.begin();  i != entries.end();) {
+		const string &name= i->first;
+		bool erase= false;
+		for (size_t k= name.find('/');  k != string::npos;  k= name.find('/', k + 1)) {
+			if (prefixes.count(name.substr(0, k + 1))) {
+				erase= true;
+				break;
+			}
+		}
+		if (erase) {
+			i= entries.erase(i);
+			changed= true;
+		} else {
+			++i;
+		}
+	}
+}
+
+void Change_Journal::get_entry(int ret, const struct stat *buf, Entry &entry)
+/* RET is the return value of stat() */
+{
+	memset(&entry, 0, sizeof(entry));
+	if (ret == 0) {
+		entry.exists= 1;
+		entry.mode= buf->st_mode;
+		entry.size= buf->st_size;
+		entry.mtime_sec= buf->st_mtime;
+#if USE_MTIM
+		entry.mtime_nsec= buf->st_mtim.tv_nsec;
+#endif
+	}
+}
+
+bool Change_Journal::is_recordable(const char *filename_stat)
+/* Files outside of the current directory, and files reached through
+ * symbolic links, are not watched */
+{
+	if (filename_stat[0] == '/' || filename_stat[0] == '\0' ||
+	    ! strcmp(filename_stat, "..") || ! strncmp(filename_stat, "../", 3) ||
+	    strchr(filename_stat, '\n'))
+		return false;
+
+	for (const char *p= strchr(filename_stat, '/');  p;  p= strchr(p + 1, '/')) {
+		string dir(filename_stat, p + 1 - filename_stat);
+		auto i= dirs_recordable.find(dir);
+		bool recordable;
+		if (i != dirs_recordable.end()) {
+			recordable= i->second;
+		} else {
+			struct stat buf;
+			int ret= lstat(dir.c_str(), &buf);
+			recordable= ret == 0 ? S_ISDIR(buf.st_mode) : errno == ENOENT;
+			dirs_recordable[dir]= recordable;
+		}
+		if (! recordable)
+			return false;
+	}
+
+	struct stat buf;
+	if (lstat(filename_stat, &buf) < 0)
+		return errno == ENOENT;
+	return ! S_ISLNK(buf.st_mode);
+}
+
+string Change_Journal::get_cwd()
+{
+	char b[PATH_MAX];
+	if (getcwd(b, sizeof(b)) == nullptr) {
+		print_error_system("getcwd");
+		exit(ERROR_FATAL);
+	}
+	return b;
+}
+
+bool Change_Journal::write_all(int fd, const string &out)
+{
+	for (size_t k= 0;  k < out.size();) {
+		ssize_t r= write(fd, out.c_str() + k, out.size() - k);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		k += r;
+	}
+	return true;
+}
+
+#if HAVE_INOTIFY
+
+int Change_Journal::start(const string &cwd)
+/* Write a new journal, and return a file descriptor to which changes
+ * are appended */
+{
+	struct timespec t;
+	if (clock_gettime(CLOCK_REALTIME, &t) < 0) {
+		print_error_system("clock_gettime");
+		exit(ERROR_FATAL);
+	}
+	string header= CHANGE_JOURNAL_MAGIC;
+	header += frmt("%ld.%ld.%ld", (long) getpid(), (long) t.tv_sec, (long) t.tv_nsec);
+	header += ' ';
+	header += cwd;
+	header += '\n';
+
+	/* The new journal is locked before it replaces the old one */
+	string filename_tmp= filename + ".tmp";
+	int fd= open(filename_tmp.c_str(),
+		     O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+	if (fd < 0)
+		goto error;
+	struct flock lock;
+	lock.l_type= F_WRLCK;
+	lock.l_whence= SEEK_SET;
+	lock.l_start= 0;
+	lock.l_len= 0;
+	if (fcntl(fd, F_SETLK, &lock) < 0 ||
+	    write(fd, header.c_str(), header.size()) != (ssize_t) header.size() ||
+	    rename(filename_tmp.c_str(), filename.c_str()) < 0)
+		goto error;
+	return fd;
+
+ error:
+	print_error_system(filename_tmp);
+	unlink(filename_tmp.c_str());
+	exit(ERROR_FATAL);
+}
+
+void Change_Journal::watch_tree(int fd_inotify,
+				unordered_map <int, string> &watches,
+				const string &dir)
+{
+	const char *name= dir.empty() ? "." : dir.c_str();
+	int wd= inotify_add_watch
+		(fd_inotify, name,
+		 IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE |
+		 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+		 IN_DONT_FOLLOW | IN_ONLYDIR | IN_EXCL_UNLINK);
+	if (wd < 0) {
+		if (errno == ENOSPC) {
+			print_error(fmt("Too many directories to watch in %s; "
+					"increase the limit in %s",
+					name_format_word(name),
+					name_format_word("/proc/sys/fs/inotify/max_user_watches")));
+			exit(ERROR_FATAL);
+		}
+		/* The directory was removed in the meantime, or is not
+		 * accessible */
+		return;
+	}
+	watches[wd]= dir;
+
+	DIR *d= opendir(name);
+	if (d == nullptr)
+		return;
+	struct dirent *entry;
+	while ((entry= readdir(d)) != nullptr) {
+		if (! strcmp(entry->d_name, ".") || ! strcmp(entry->d_name, ".."))
+			continue;
+		string sub= dir + entry->d_name;
+		bool is_dir= entry->d_type == DT_DIR;
+		if (entry->d_type == DT_UNKNOWN) {
+			struct stat buf;
+			is_dir= lstat(sub.c_str(), &buf) == 0 && S_ISDIR(buf.st_mode);
+		}
+		if (is_dir)
+			watch_tree(fd_inotify, watches, sub + '/');
+	}
+	closedir(d);
+}
+
+void Change_Journal::read_events(int fd_inotify,
+				 unordered_map <int, string> &watches,
+				 vector <string> &lines)
+{
+	alignas(struct inotify_event) char b[1 << 16];
+	ssize_t r;
+	while ((r= read(fd_inotify, b, sizeof(b))) < 0 && errno == EINTR) ;
+	if (r < 0) {
+		if (errno == EAGAIN)
+			return;
+		print_error_system("inotify");
+		exit(ERROR_FATAL);
+	}
+
+	for (const char *p= b;  p < b + r;) {
+		const struct inotify_event *event= (const struct inotify_event *) p;
+		p += sizeof(struct inotify_event) + event->len;
+
+		string line;
+		if (event->mask & IN_Q_OVERFLOW) {
+			/* Directories may have been created in the
+			 * meantime */
+			watch_tree(fd_inotify, watches, "");
+			line= "!";
+		} else {
+			auto i= watches.find(event->wd);
+			if (i == watches.end())
+				continue;
+			const string dir= i->second;
+			if (event->mask & IN_IGNORED) {
+				watches.erase(i);
+				continue;
+			}
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				/* A directory moved within the tree is
+				 * given its new name when the event
+				 * IN_MOVED_TO is processed */
+				line= dir.empty() ? "!" : dir;
+			} else if (event->len == 0) {
+				continue;
+			} else {
+				string name= dir + event->name;
+				if (dir.empty() &&
+				    ! strncmp(event->name, CHANGE_JOURNAL_SYNC_PREFIX,
+					      strlen(CHANGE_JOURNAL_SYNC_PREFIX))) {
+					if (! (event->mask & IN_CREATE))
+						continue;
+					line= ':' + name;
+				} else if (event->mask & IN_ISDIR) {
+					line= name + '/';
+					if (event->mask & (IN_CREATE | IN_MOVED_TO))
+						watch_tree(fd_inotify, watches, line);
+				} else {
+					line= name;
+				}
+			}
+			if (line.find('\n') != string::npos)
+				line= dir.empty() ? "!" : dir;
+		}
+		lines.push_back(line);
+	}
+}
+
+#endif /* HAVE_INOTIFY */
+
+bool Change_Journal::read_u64(const char *&p, const char *p_end, uint64_t &x)
+{
+	if ((size_t)(p_end - p) < sizeof(x))
+		return false;
+	memcpy(&x, p, sizeof(x));
+	p += sizeof(x);
+	return true;
+}
+
+bool Change_Journal::read_string(const char *&p, const char *p_end, string &s)
+{
+	uint64_t size;
+	if (! read_u64(p, p_end, size) || (uint64_t)(p_end - p) < size)
+		return false;
+	s.assign(p, size);
+	p += size;
+	return true;
+}
+
+#endif /* ! JOURNAL_HH */
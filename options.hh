@@ -10,6 +10,9 @@
 static bool option_nontrivial= false;
 /* The -a option (consider all trivial dependencies to be non-trivial) */ 
 
+static bool option_atomic= false;
+/* The -A option (write redirected output and content atomically) */ 
+
 static bool option_debug= false;
 /* The -d option (debug mode) */ 
 
@@ -31,6 +34,9 @@ static bool option_keep_going= false;
 static bool option_no_delete= false;
 /* The -K option (don't delete partially built files) */
 
+static bool option_list_dirs= false;
+/* The -l option (recognize missing targets from directory listings) */
+
 static bool option_print= false;
 /* The -P option (print rules) */
 
@@ -83,12 +83,30 @@ public:
 	/* Parse tokens that represent an 'expression_list' (as given in
 	 * the manpage).  DEPS is filled.  DEPS is empty when called.  */
 
+	static void get_expression_list_file(vector <shared_ptr <const Dep> > &deps,
+					     const char *filename, 
+					     Flags flags,
+					     const Printer &printer);
+	/* Read a dynamic dependency from FILENAME that is not in Stu
+	 * syntax, as given by the attribute flags in FLAGS (-n, -0 or
+	 * -d).  Write result into DEPS.  Throws errors.  */
+
 	static void get_expression_list_delim(vector <shared_ptr <const Dep> > &deps,
-					      const char *filename, 
+					      const char *filename,
+					      const char *in, size_t in_size,
 					      char c, char c_printed,
-					      const Printer &printer);
-	/* Read delimiter-separated dynamic dependency from FILENAME,
-	 * delimited by C.  Write result into DEPS.  Throws errors.  */
+					      const Printer &printer,
+					      size_t line= 0);
+	/* Parse the content IN of length IN_SIZE of the file FILENAME as
+	 * a list of filenames delimited by C (-n and -0).  LINE is the
+	 * number of entries that precede IN in the file.  */ 
+
+	static void get_expression_list_make(vector <shared_ptr <const Dep> > &deps,
+					     const char *filename,
+					     const char *in, size_t in_size,
+					     const Printer &printer);
+	/* Parse the content IN of length IN_SIZE of the file FILENAME as
+	 * a dependency file in Make syntax (-d).  */
 
 	static void get_target_arg(vector <shared_ptr <const Dep> > &deps, 
 				   int argc, const char *const *argv); 
@@ -187,11 +205,12 @@ private:
 	static void print_separation_message(shared_ptr <const Token> token); 
 
 	static void append_copy(      Name &to,
+				bool slash,
 				const Name &from);
-	/* If TO ends in '/', append to it the part of FROM that
-	 * comes after the last slash, or the full target if it contains
-	 * no slashes.  Parameters are not considered for containing
-	 * slashes */
+	/* If SLASH, i.e., TO ended in '/' before it was canonicalized,
+	 * append to it the part of FROM that comes after the last
+	 * slash, or the full target if it contains no slashes.
+	 * Parameters are not considered for containing slashes */
 };
 
 void Parser::parse_rule_list(vector <shared_ptr <const Rule> > &ret)
@@ -598,7 +617,8 @@ shared_ptr <const Rule> Parser::parse_rule()
 
 			/* Append target name when source ends
 			 * in slash */
-			append_copy(*name_copy, place_param_targets[0]->place_name); 
+			append_copy(*name_copy, name_copy->slash,
+				    place_param_targets[0]->place_name); 
 
 			return make_shared <const Rule> (place_param_targets[0], name_copy,
 							 place_flag_persistent,
@@ -1208,12 +1228,18 @@ shared_ptr <const Dep> Parser::parse_redirect_dep
 }
 
 void Parser::append_copy(      Name &to,
+			 bool slash,
 			 const Name &from) 
 {
-	/* Only append if TO ends in a slash */
+	/* Only append if TO ended in a slash */
+	if (! slash)
+		return;
+
+	/* Canonicalization has removed the slash, except when TO is
+	 * the root directory */
 	if (! (to.last_text().size() != 0 &&
 	       to.last_text().back() == '/')) {
-		return;
+		to.append_text("/"); 
 	}
 
 	for (ssize_t i= from.get_n();  i >= 0;  --i) {
@@ -1229,6 +1255,7 @@ void Parser::append_copy(      Name &to,
 					to.append_parameter(from.get_parameters()[k]);
 					to.append_text(from.get_texts()[k + 1]);
 				}
+				to.canonicalize(); 
 				return;
 			}
 		}
@@ -1237,6 +1264,7 @@ void Parser::append_copy(      Name &to,
 	/* FROM does not contain slashes;
 	 * prepend the whole FROM to TO */
 	to.append(from);
+	to.canonicalize(); 
 }
 
 void Parser::get_rule_list(vector <shared_ptr <const Rule> > &rules,
@@ -1275,49 +1303,159 @@ void Parser::get_expression_list(vector <shared_ptr <const Dep> > &deps,
 	}
 }
 
+void Parser::get_expression_list_file(vector <shared_ptr <const Dep> > &deps,
+				      const char *filename, 
+				      Flags flags,
+				      const Printer &printer)
+/* The file is mapped into memory with mmap().  Files that cannot be
+ * mapped, such as pipes, are read into memory first.  Unlike with
+ * read(), a file that is truncated by another process while it is
+ * being parsed leads to SIGBUS.  */ 
+{
+	assert(flags & F_ATTRIBUTE); 
+
+	const char *in= nullptr;
+	size_t in_size= 0;
+	bool use_malloc= false;
+	/* False:  use mmap()
+	 * True:   use malloc()  */
+	struct stat buf; 
+
+	int fd= open(filename, O_RDONLY); 
+	if (fd < 0) 
+		goto error;
+
+	if (0 > fstat(fd, &buf)) 
+		goto error_close; 
+
+	if (S_ISREG(buf.st_mode) && buf.st_size == 0) {
+		/* mmap() may fail on empty files */ 
+		if (0 > close(fd))
+			goto error; 
+		return; 
+	}
+
+	if (S_ISREG(buf.st_mode)) {
+		in_size= buf.st_size;
+		in= (const char *) mmap(nullptr, in_size, 
+					PROT_READ, MAP_SHARED, fd, 0);
+	}
+	if (! S_ISREG(buf.st_mode) || in == MAP_FAILED) {
+		use_malloc= true; 
+		in= nullptr;
+		in_size= 0; 
+		size_t size_alloc= 0; 
+		while (true) {
+			if (in_size == size_alloc) {
+				size_alloc= size_alloc ? 2 * size_alloc : 0x1000; 
+				if (size_alloc <= in_size) {
+					errno= ENOMEM;
+					goto error_free;
+				}
+				char *in_new= (char *) realloc((void *) in, size_alloc); 
+				if (in_new == nullptr) 
+					goto error_free; 
+				in= in_new; 
+			}
+			ssize_t r= read(fd, (void *) (in + in_size), size_alloc - in_size);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				goto error_free;
+			}
+			if (r == 0)
+				break;
+			in_size += r; 
+		}
+	}
+
+	if (0 > close(fd)) {
+		fd= -1; 
+		goto error_free; 
+	}
+
+	try {
+		if (flags & F_NEWLINE_SEPARATED) 
+			get_expression_list_delim(deps, filename, in, in_size, 
+						  '\n', 'n', printer); 
+		else if (flags & F_NUL_SEPARATED) 
+			get_expression_list_delim(deps, filename, in, in_size, 
+						  '\0', '0', printer); 
+		else 
+			get_expression_list_make(deps, filename, in, in_size, 
+						 printer); 
+	} catch (int) {
+		if (use_malloc)
+			free((void *) in);
+		else
+			munmap((void *) in, in_size); 
+		throw; 
+	}
+
+	if (use_malloc) {
+		free((void *) in); 
+	} else if (0 > munmap((void *) in, in_size)) {
+		goto error; 
+	}
+	return; 
+
+ error_free:
+	{
+		int errno_save= errno;
+		if (use_malloc)
+			free((void *) in);
+		else
+			munmap((void *) in, in_size); 
+		errno= errno_save; 
+	}
+ error_close:
+	if (fd >= 0) {
+		int errno_save= errno;
+		close(fd); 
+		errno= errno_save; 
+	}
+ error:
+	print_error_system(filename); 
+	throw ERROR_BUILD; 
+}
+
 void Parser::get_expression_list_delim(vector <shared_ptr <const Dep> > &deps,
-				       const char *filename, 
+				       const char *filename,
+				       const char *in, size_t in_size,
 				       char c, char c_printed,
-				       const Printer &printer)
-/* We use getdelim() for parsing.  A more optimized way would be via
- * mmap()+strchr(), but why the complexity?  */ 
+				       const Printer &printer,
+				       size_t line)
 {
-	char *lineptr= nullptr;
-	size_t n= 0;
-	ssize_t len;
-			
-	FILE *file= fopen(filename, "r"); 
-	if (file == nullptr) {
-		print_error_system(filename); 
-		throw ERROR_BUILD; 
+	const char *const in_end= in + in_size; 
+
+	/* Count the entries first, so that DEPS is allocated only once */
+	size_t count= 0;
+	for (const char *p= in;  p < in_end;  ++p) {
+		p= (const char *) memchr(p, c, in_end - p); 
+		if (p == nullptr)
+			break;
+		++count; 
 	}
+	deps.reserve(deps.size() + count + 1); 
 
-	Place place(Place::Type::INPUT_FILE, filename, 0, 0); 
+	Place place(Place::Type::INPUT_FILE, filename, line, 0); 
 
-	while ((len= getdelim(&lineptr, &n, c, file)) >= 0) {
+	const char *p= in;
+	while (p < in_end) {
 
 		++place.line;
-				
-		/* LEN is at least one by the specification of
-		 * getdelim().  */ 
-		assert(len >= 1); 
-
-		assert(lineptr[len] == '\0'); 
-				
-		/* There may or may not be a terminating \n or \0.
-		 * getdelim(3) will include it if it is present, but the
-		 * file may not have one for the last entry.  */ 
 
-		if (lineptr[len - 1] == c) {
-			--len; 
-		}
+		/* There may or may not be a terminating \n or \0 for
+		 * the last entry.  */ 
+		const char *p_delim= (const char *) memchr(p, c, in_end - p);
+		if (p_delim == nullptr)
+			p_delim= in_end; 
+		const size_t len= p_delim - p; 
 
 		/* An empty line: This corresponds to an empty filename,
 		 * and thus we treat is as a syntax error, because
 		 * filenames can never be empty.  */ 
 		if (len == 0) {
-			free(lineptr); 
-			fclose(file); 
 			place << "filename must not be empty"; 
 			printer <<
 				fmt("in %s-separated dynamic dependency %s "
@@ -1329,11 +1467,9 @@ void Parser::get_expression_list_delim(vector <shared_ptr <const Dep> > &deps,
 			throw ERROR_LOGICAL; 
 		}
 				
-		string filename_dep= string(lineptr, len); 
+		string filename_dep(p, len); 
 
-		if (c != '\0' && filename_dep.find('\0') != string::npos) {
-			free(lineptr); 
-			fclose(file);
+		if (c != '\0' && memchr(p, '\0', len) != nullptr) {
 			place << fmt("filename %s must not contain %s",
 				     name_format_word(filename_dep),
 				     char_format_word('\0')); 
@@ -1346,22 +1482,168 @@ void Parser::get_expression_list_delim(vector <shared_ptr <const Dep> > &deps,
 				    (frmt("-%c", c_printed)));
 			throw ERROR_LOGICAL; 
 		}
-		if (c == '\0') {
-			assert(filename_dep.find('\0') == string::npos); 
-		}
 
+		Name::canonicalize_text(filename_dep, true, true); 
 		deps.push_back
 			(make_shared <Plain_Dep>
 			 (0,
 			  Place_Param_Target
 			  (0, 
-			   Place_Name(filename_dep, place)))); 
+			   Place_Name(move(filename_dep), place)))); 
+
+		p= p_delim + 1; 
 	}
-	free(lineptr); 
-	if (fclose(file)) {
-		print_error_system(filename); 
-		throw ERROR_BUILD; 
+}
+
+void Parser::get_expression_list_make(vector <shared_ptr <const Dep> > &deps,
+				      const char *filename,
+				      const char *in, size_t in_size,
+				      const Printer &printer)
+/* 
+ * Dependency files as generated by compilers (e.g. 'cc -MD') contain
+ * rules of the form 
+ *
+ *	TARGET ... : PREREQUISITE ...
+ *
+ * The prerequisites of all rules are used as dependencies; the
+ * targets are ignored.  Rules without prerequisites, as generated by
+ * 'cc -MP', are therefore ignored.  A backslash at the end of a line
+ * continues the line.  In names, the sequences '\ ', '\#' and '\:'
+ * stand for the escaped character, '$$' stands for '$', and all other
+ * characters are taken literally, as in Make.  A colon ends the
+ * targets only when it is followed by whitespace, so that names such
+ * as 'C:/x' are possible.  An unescaped '#' starts a comment.
+ * This is done in a single pass over the input.
+ */
+{
+	const char *p= in;
+	const char *const p_end= in + in_size; 
+	size_t line= 1;
+	const char *p_line= in; 
+	const Place place_file(Place::Type::INPUT_FILE, filename, 1, 0); 
+
+	bool has_target= false;
+	/* Whether the current rule has at least one target */ 
+
+	bool has_colon= false;
+	/* Whether the colon of the current rule was seen */ 
+
+	while (true) {
+
+		/* End of a rule */ 
+		if (p == p_end || *p == '\n') {
+			if (has_target && ! has_colon) {
+				Place(place_file, line, p - p_line)
+					<< fmt("expected %s after target names",
+					       char_format_word(':')); 
+				goto error; 
+			}
+			if (p == p_end)
+				break;
+			has_target= has_colon= false;
+			++p;
+			++line;
+			p_line= p; 
+		}
+
+		/* Line continuation */ 
+		else if (*p == '\\' && p + 1 < p_end && 
+			 (p[1] == '\n' || 
+			  (p[1] == '\r' && p + 2 < p_end && p[2] == '\n'))) {
+			p += p[1] == '\n' ? 2 : 3; 
+			++line;
+			p_line= p; 
+		}
+
+		/* Whitespace */ 
+		else if (*p == ' ' || *p == '\t' || *p == '\r') {
+			++p; 
+		}
+
+		/* Comment */ 
+		else if (*p == '#') {
+			p= (const char *) memchr(p, '\n', p_end - p); 
+			if (p == nullptr)
+				p= p_end; 
+		}
+
+		/* Separator between targets and prerequisites */ 
+		else if (*p == ':' && 
+			 (p + 1 == p_end || isspace(p[1]))) {
+			Place place_colon(place_file, line, p - p_line); 
+			if (! has_target) {
+				place_colon << 
+					fmt("expected a target name before %s", 
+					    char_format_word(':')); 
+				goto error; 
+			}
+			if (has_colon) {
+				place_colon << 
+					fmt("expected a prerequisite name, not %s", 
+					    char_format_word(':'));
+				goto error; 
+			}
+			has_colon= true;
+			++p; 
+		}
+
+		/* Name */ 
+		else {
+			Place place_name(place_file, line, p - p_line); 
+			string name;
+			while (p < p_end) {
+				if (*p == '\\' && p + 1 < p_end &&
+				    (p[1] == ' ' || p[1] == '#' || p[1] == ':')) {
+					name += p[1];
+					p += 2; 
+				} else if (*p == '$' && p + 1 < p_end && p[1] == '$') {
+					name += '$';
+					p += 2; 
+				} else if (isspace(*p) || *p == '#' ||
+					   (*p == '\\' && p + 1 < p_end && 
+					    (p[1] == '\n' || 
+					     (p[1] == '\r' && p + 2 < p_end && p[2] == '\n'))) ||
+					   (*p == ':' && (p + 1 == p_end || isspace(p[1])))) {
+					break; 
+				} else {
+					const char *const p_run= p++;
+					while (p < p_end && ! isspace(*p) && *p != '#' && 
+					       *p != '\\' && *p != '$' && *p != ':')
+						++p; 
+					name.append(p_run, p - p_run); 
+				}
+			}
+			assert(! name.empty()); 
+
+			if (name.find('\0') != string::npos) {
+				place_name << fmt("filename %s must not contain %s",
+						  name_format_word(name),
+						  char_format_word('\0')); 
+				goto error; 
+			}
+
+			if (! has_colon) {
+				has_target= true;
+			} else {
+				Name::canonicalize_text(name, true, true); 
+				deps.push_back
+					(make_shared <Plain_Dep>
+					 (0,
+					  Place_Param_Target
+					  (0, 
+					   Place_Name(move(name), place_name))));
+			}
+		}
 	}
+
+	return; 
+
+ error:
+	printer << 
+		fmt("in Make-format dynamic dependency %s declared with flag %s",
+		    name_format_word(filename),
+		    multichar_format_word("-d"));
+	throw ERROR_LOGICAL; 
 }
 
 void Parser::get_target_arg(vector <shared_ptr <const Dep> > &deps, 
@@ -1446,6 +1728,10 @@ void Parser::get_target_arg(vector <shared_ptr <const Dep> > &deps,
 				}
 				assert(p > q); 
 				Place_Name place_name(string(q, p-q), place); 
+				/* Canonicalize partially when concatenated */
+				place_name.canonicalize
+					(q == argv[j] || q[-1] != ']',
+					 *p != '['); 
 				tokens.push_back(make_shared <Name_Token> (place_name, beginning_of_arg)); 
 				allow_dash= false;
 				allow_at= false; 
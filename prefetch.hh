@@ -0,0 +1,338 @@
+#ifndef PREFETCH_HH
+#define PREFETCH_HH
+
+/*
+ * Prefetching of stat() results, enabled with the -S option.  When a
+ * file dependency is added to an execution, a request to stat() the
+ * file is queued, and is executed by one of a fixed number of helper
+ * threads.  When the execution later needs the information (i.e., when
+ * all its children are done), the result is taken from the prefetched
+ * entry instead of calling stat() again.  On file systems with a high
+ * latency for stat(), e.g. NFS, this lets many stat() calls proceed in
+ * parallel while the dependency graph is being walked.
+ *
+ * A prefetched result is only used when no file can have been modified
+ * by Stu between the time it was requested and the time it is used.
+ * Therefore, requests are only made while no job is running, and a
+ * result is discarded if a job has been started or a content file has
+ * been written since the request was made.  This makes prefetching
+ * mostly useful for builds in which many files are up to date.
+ *
+ * The helper threads only call stat() and wait on a condition variable.
+ * They do not allocate memory and have all signals blocked, so that
+ * signals are received by the main thread as before.  They never
+ * access Dep, Rule or Execution objects, or any shared_ptr<>.  All
+ * other operations are performed by the main thread.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <unordered_map>
+
+class Stat_Prefetch
+{
+public:
+	static void init(long threads);
+	/* Enable prefetching with the given number of helper threads,
+	 * which is the maximal number of stat() calls in flight.  Called
+	 * just before the execution, after any fork() of the server or
+	 * the watch mode, because threads are not inherited by the
+	 * child.  */
+
+	static bool enabled() {  return threads_count != 0;  }
+
+	static void request(const char *filename);
+	/* Add a stat() of FILENAME to the current batch.  Must only be
+	 * called while no job is running.  Does nothing when
+	 * prefetching is disabled, or when too many results are
+	 * pending.  */
+
+	static int stat(const char *filename, struct stat *buf);
+	/* Like stat(2), including the setting of ERRNO.  Uses the
+	 * prefetched result when it is valid.  */
+
+	static void modified() {  ++generation;  }
+	/* Called when Stu may modify files, i.e., before a job is
+	 * started or a file with content is written.  Invalidates all
+	 * results requested until now.  */
+
+private:
+	enum State {  QUEUED, RUNNING, DONE  };
+
+	enum Place_Entry {  IN_BATCH, IN_QUEUE, IN_NONE  };
+	/* Where an entry is kept, apart from ENTRIES:  in BATCH, in
+	 * QUEUE, or nowhere (after the queue was emptied).  */
+
+	struct Entry
+	{
+		string filename;
+		unsigned long generation;
+		State state;
+		Place_Entry place;
+		bool cancelled;
+		/* The entry has been removed from ENTRIES, and is deleted
+		 * when it leaves BATCH or QUEUE */
+		int ret;
+		int errno_stat;
+		struct stat buf;
+	};
+
+	static const size_t PENDING_MAX= 1 << 16;
+	/* Maximal number of entries */
+
+	static const size_t BATCH_MAX= 256;
+
+	static long threads_count;
+	static unsigned long generation;
+
+	static unordered_map <string, Entry *> entries;
+	/* Entries that are not cancelled, by filename.  Only used by the
+	 * main thread.  */
+
+	static vector <Entry *> batch;
+	/* Entries not yet passed to the helper threads.  Only used by
+	 * the main thread.  The batch is passed on when it is full, and
+	 * when the main thread needs a result.  */
+
+	static pthread_mutex_t mutex;
+	static pthread_cond_t cond_work, cond_done;
+
+	/* The following variables are protected by MUTEX */
+	static vector <Entry *> *queue;
+	/* Entries passed to the helper threads.  Entries from index
+	 * QUEUE_NEXT on are not yet taken by a helper thread.  Taken
+	 * entries are kept until the whole queue is done, so that they
+	 * can be deleted by the main thread.  Allocated in init() and
+	 * never destroyed, as the helper threads may still access it
+	 * when Stu exits.  */
+	static size_t queue_next;
+	static size_t queue_running;
+	/* Number of entries currently being processed by helper
+	 * threads */
+
+	static void flush();
+	/* Pass the current batch to the helper threads */
+
+	static void cancel(Entry *entry);
+	/* Mark ENTRY as cancelled, or delete it.  The entry must have
+	 * been removed from ENTRIES.  Must be called with MUTEX
+	 * locked when the entry is in QUEUE.  */
+
+	static void collect();
+	/* Empty the queue and delete the cancelled entries when all
+	 * entries in the queue are done.  Must be called with MUTEX
+	 * locked.  */
+
+	static void *loop(void *);
+	/* The helper thread */
+};
+
+long Stat_Prefetch::threads_count= 0;
+unsigned long Stat_Prefetch::generation= 0;
+unordered_map <string, Stat_Prefetch::Entry *> Stat_Prefetch::entries;
+vector <Stat_Prefetch::Entry *> Stat_Prefetch::batch;
+pthread_mutex_t Stat_Prefetch::mutex;
+pthread_cond_t Stat_Prefetch::cond_work, Stat_Prefetch::cond_done;
+vector <Stat_Prefetch::Entry *> *Stat_Prefetch::queue= nullptr;
+size_t Stat_Prefetch::queue_next= 0;
+size_t Stat_Prefetch::queue_running= 0;
+
+void Stat_Prefetch::init(long threads)
+{
+	assert(threads > 0);
+	assert(threads_count == 0);
+
+	queue= new vector <Entry *>;
+	if (0 != (errno= pthread_mutex_init(&mutex, nullptr)) ||
+	    0 != (errno= pthread_cond_init(&cond_work, nullptr)) ||
+	    0 != (errno= pthread_cond_init(&cond_done, nullptr))) {
+		perror("pthread_mutex_init");
+		exit(ERROR_FATAL);
+	}
+
+	/* The helper threads inherit the signal mask */
+	sigset_t set_all, set_old;
+	sigfillset(&set_all);
+	if (0 != pthread_sigmask(SIG_BLOCK, &set_all, &set_old)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+
+	for (long i= 0;  i < threads;  ++i) {
+		pthread_t thread;
+		int r= pthread_create(&thread, nullptr, loop, nullptr);
+		if (r != 0) {
+			/* Use the threads that could be created */
+			if (i == 0) {
+				errno= r;
+				perror("pthread_create");
+			}
+			break;
+		}
+		pthread_detach(thread);
+		++threads_count;
+	}
+
+	if (0 != pthread_sigmask(SIG_SETMASK, &set_old, nullptr)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+}
+
+void Stat_Prefetch::request(const char *filename)
+{
+	if (! threads_count)
+		return;
+	if (entries.size() >= PENDING_MAX)
+		return;
+
+	auto i= entries.find(filename);
+	if (i != entries.end()) {
+		if (i->second->generation == generation)
+			return;
+		/* A previous request is out of date; replace it */
+		Entry *entry_old= i->second;
+		entries.erase(i);
+		pthread_mutex_lock(&mutex);
+		cancel(entry_old);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	Entry *entry= new Entry;
+	entry->filename= filename;
+	entry->generation= generation;
+	entry->state= QUEUED;
+	entry->place= IN_BATCH;
+	entry->cancelled= false;
+	entries[entry->filename]= entry;
+	batch.push_back(entry);
+	if (batch.size() >= BATCH_MAX)
+		flush();
+}
+
+void Stat_Prefetch::flush()
+{
+	if (batch.empty())
+		return;
+	pthread_mutex_lock(&mutex);
+	collect();
+	size_t count= 0;
+	for (Entry *entry:  batch) {
+		if (entry->cancelled) {
+			delete entry;
+			continue;
+		}
+		entry->place= IN_QUEUE;
+		queue->push_back(entry);
+		++count;
+	}
+	if (count == 1)
+		pthread_cond_signal(&cond_work);
+	else if (count > 1)
+		pthread_cond_broadcast(&cond_work);
+	pthread_mutex_unlock(&mutex);
+	batch.clear();
+}
+
+int Stat_Prefetch::stat(const char *filename, struct stat *buf)
+{
+	if (entries.empty())
+		return ::stat(filename, buf);
+
+	auto i= entries.find(filename);
+	if (i == entries.end()) {
+		flush();
+		return ::stat(filename, buf);
+	}
+
+	Entry *entry= i->second;
+	entries.erase(i);
+
+	if (entry->place == IN_BATCH) {
+		/* Requested just now; not worth waking up a helper
+		 * thread */
+		cancel(entry);
+		flush();
+		return ::stat(filename, buf);
+	}
+
+	flush();
+	pthread_mutex_lock(&mutex);
+	bool use= false;
+	int ret= -1, errno_stat= 0;
+	if (entry->generation == generation) {
+		/* When the request is being processed, wait for it; when
+		 * it is still in the queue, it is faster to call stat()
+		 * ourselves */
+		while (entry->state == RUNNING)
+			pthread_cond_wait(&cond_done, &mutex);
+		if (entry->state == DONE) {
+			use= true;
+			ret= entry->ret;
+			errno_stat= entry->errno_stat;
+			*buf= entry->buf;
+		}
+	}
+	cancel(entry);
+	collect();
+	pthread_mutex_unlock(&mutex);
+
+	if (! use)
+		return ::stat(filename, buf);
+
+	errno= errno_stat;
+	return ret;
+}
+
+void Stat_Prefetch::cancel(Entry *entry)
+{
+	assert(! entry->cancelled);
+	if (entry->place == IN_NONE)
+		delete entry;
+	else
+		entry->cancelled= true;
+}
+
+void Stat_Prefetch::collect()
+{
+	if (queue_next != queue->size() || queue_running != 0)
+		return;
+	for (Entry *entry:  *queue) {
+		if (entry->cancelled)
+			delete entry;
+		else
+			entry->place= IN_NONE;
+	}
+	queue->clear();
+	queue_next= 0;
+}
+
+void *Stat_Prefetch::loop(void *)
+{
+	pthread_mutex_lock(&mutex);
+	for (;;) {
+		while (queue_next == queue->size())
+			pthread_cond_wait(&cond_work, &mutex);
+		Entry *entry= (*queue)[queue_next++];
+		if (entry->cancelled)
+			continue;
+		entry->state= RUNNING;
+		++queue_running;
+		pthread_mutex_unlock(&mutex);
+
+		int ret= ::stat(entry->filename.c_str(), &entry->buf);
+		int errno_stat= errno;
+
+		pthread_mutex_lock(&mutex);
+		entry->ret= ret;
+		entry->errno_stat= errno_stat;
+		entry->state= DONE;
+		--queue_running;
+		pthread_cond_broadcast(&cond_done);
+	}
+	return nullptr;
+}
+
+#endif /* ! PREFETCH_HH */
@@ -0,0 +1,666 @@
+#ifndef SERVER_HH
+#define SERVER_HH
+
+/*
+ * The server mode, enabled with the -u option.  Stu reads its input
+ * files once and then listens on a Unix socket instead of building.
+ * Each request is made by an invocation of Stu with -U, the client,
+ * which passes its arguments, its working directory and its standard
+ * file descriptors to the server.  The server handles each request in
+ * a child process, which inherits the parsed rules and continues like
+ * a regular invocation of Stu with the arguments of the client, using
+ * the file descriptors of the client as standard input and output.
+ * The exit status of the child is then passed back to the client, which
+ * exits with it.
+ *
+ * Before each request, the server checks whether any of the Stu files
+ * it has read has changed.  In that case, the child reads them again,
+ * such that errors are reported to the client, and the server then
+ * reads them again itself.  The state of the file system is not kept
+ * between requests; in combination with -L, each request only checks
+ * the files that the journal reports as changed.
+ *
+ * Requests are handled one after the other.  When a client terminates
+ * before its request is finished, the child is terminated.  Commands
+ * are run with the environment of the server.
+ *
+ * Since a request runs commands as the user of the server, the socket
+ * is created accessible only to that user, and connections from
+ * processes of other users are closed without reading the request,
+ * where the system allows to check this (SO_PEERCRED or
+ * getpeereid()).  
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "journal.hh"
+#include "execution.hh"
+#include "parser.hh"
+
+class Server
+{
+public:
+	static void init(const char *socket_name);
+	/* Called when the -u option is processed */
+
+	static bool is_server() {  return ! name.empty() && ! child;  }
+	/* Whether this is the server process */
+
+	static bool is_child() {  return child;  }
+	/* Whether this is a process handling a request */
+
+	static void add_input(char option, const string &text);
+	/* Record an input file (OPTION is 'f'), or rules passed with -F
+	 * (OPTION is 'F'), in the order in which they are read.  The
+	 * default input file is passed as "".  */
+
+	static void run(int &argc, char **&argv,
+			shared_ptr <const Rule> &rule_first,
+			Place &place_first);
+	/* Listen on the socket and handle requests.  Returns only in
+	 * the child process handling a request, with ARGC and ARGV set
+	 * to the arguments of the client.  The rules are in
+	 * Execution::rule_set.  */
+
+	static void client(int argc, char **argv);
+	/* Called when the first argument is the -U option.  Pass the
+	 * other arguments to the server listening on the given socket,
+	 * and exit with the exit status of the request.  Does not
+	 * return.  */
+
+	static void check_option(char option);
+	/* Fail when OPTION cannot be used by a client */
+
+private:
+	struct Signature {
+		string filename;
+		dev_t dev;
+		ino_t ino;
+		off_t size;
+		Timestamp timestamp;
+	};
+
+	static string name;
+	/* The name of the socket; empty when not in server mode */
+
+	static bool child;
+
+	static vector <pair <char, string> > inputs;
+
+	static vector <Signature> signatures;
+	/* The Stu files read by the server */
+
+	static void parse(shared_ptr <const Rule> &rule_first, Place &place_first);
+	/* Read the input files again into Execution::rule_set.  Throws
+	 * errors like the parser.  */
+
+	static void reparse(shared_ptr <const Rule> &rule_first, Place &place_first);
+	/* Read the input files again in the server, without output.
+	 * The rules are only replaced when there is no error.  */
+
+	static void set_signatures();
+	static bool is_changed();
+
+	static bool is_peer_allowed(int fd);
+	/* Whether the process connected on FD belongs to the user of
+	 * the server, or the system does not allow to check */
+
+	static bool receive(int fd, int fds[3], string &payload);
+
+	static int fd_sigchld[2];
+	/* The pipe written to by handler_sigchld(), such that the
+	 * server can wait for both the child and the client using
+	 * poll() */
+
+	static void handler_sigchld(int sig);
+
+	static void send_status(int fd, int32_t status);
+	/* Send the exit status to the client, ignoring SIGPIPE */
+};
+
+const char SERVER_MAGIC[]= "stu-server-1";
+
+string Server::name;
+bool Server::child= false;
+vector <pair <char, string> > Server::inputs;
+vector <Server::Signature> Server::signatures;
+int Server::fd_sigchld[2];
+
+void Server::init(const char *socket_name)
+{
+	if (*socket_name == '\0') {
+		Place(Place::Type::OPTION, 'u') << "expected a non-empty argument";
+		exit(ERROR_FATAL);
+	}
+	if (strlen(socket_name) >= sizeof(((struct sockaddr_un *) nullptr)->sun_path)) {
+		Place(Place::Type::OPTION, 'u') <<
+			fmt("name of socket %s is too long", name_format_word(socket_name));
+		exit(ERROR_FATAL);
+	}
+	name= socket_name;
+}
+
+void Server::add_input(char option, const string &text)
+{
+	assert(option == 'f' || option == 'F');
+	inputs.push_back(pair <char, string> (option, text));
+}
+
+void Server::run(int &argc, char **&argv,
+		 shared_ptr <const Rule> &rule_first,
+		 Place &place_first)
+{
+	assert(is_server());
+
+	for (const auto &input:  inputs) {
+		if (input.first == 'f' && input.second == "-") {
+			Place(Place::Type::OPTION, 'u') <<
+				fmt("cannot be used when reading from standard input with %s",
+				    multichar_format_word("-f -"));
+			exit(ERROR_FATAL);
+		}
+	}
+
+	/* Only remove an existing socket, not other files */
+	struct stat buf;
+	if (lstat(name.c_str(), &buf) == 0 && S_ISSOCK(buf.st_mode))
+		unlink(name.c_str());
+
+	int fd_listen= socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family= AF_UNIX;
+	strcpy(addr.sun_path, name.c_str());
+	/* Only the user can connect to the socket */ 
+	mode_t mask_old= umask(077);
+	if (fd_listen < 0 ||
+	    fcntl(fd_listen, F_SETFD, FD_CLOEXEC) < 0 ||
+	    bind(fd_listen, (const struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    listen(fd_listen, SOMAXCONN) < 0) {
+		print_error_system(name);
+		exit(ERROR_FATAL);
+	}
+	umask(mask_old); 
+
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+		print_error_system("getcwd");
+		exit(ERROR_FATAL);
+	}
+
+	if (pipe(fd_sigchld) < 0) {
+		print_error_system("pipe");
+		exit(ERROR_FATAL);
+	}
+	for (int i= 0;  i < 2;  ++i) {
+		if (fcntl(fd_sigchld[i], F_SETFD, FD_CLOEXEC) < 0 ||
+		    fcntl(fd_sigchld[i], F_SETFL, O_NONBLOCK) < 0) {
+			print_error_system("fcntl");
+			exit(ERROR_FATAL);
+		}
+	}
+	struct sigaction act;
+	act.sa_handler= handler_sigchld;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags= SA_RESTART;
+	if (sigaction(SIGCHLD, &act, nullptr) < 0) {
+		print_error_system("sigaction");
+		exit(ERROR_FATAL);
+	}
+
+	set_signatures();
+	bool stale= false;
+	/* Whether the rules must be read again */
+
+	for (;;) {
+		int fd= accept(fd_listen, nullptr, nullptr);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			print_error_system(name);
+			exit(ERROR_FATAL);
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		if (! is_peer_allowed(fd)) {
+			close(fd);
+			continue;
+		}
+
+		int fds[3];
+		string payload;
+		if (! receive(fd, fds, payload)) {
+			close(fd);
+			continue;
+		}
+
+		if (! stale)
+			stale= is_changed();
+
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid= fork();
+		if (pid < 0) {
+			print_error_system("fork");
+			exit(ERROR_FATAL);
+		}
+
+		if (pid == 0) {
+			/* Child */
+			signal(SIGCHLD, SIG_DFL);
+			close(fd_sigchld[0]);
+			close(fd_sigchld[1]);
+			close(fd_listen);
+			close(fd);
+			for (int i= 0;  i < 3;  ++i) {
+				if (dup2(fds[i], i) < 0) {
+					perror("dup2");
+					exit(ERROR_FATAL);
+				}
+				close(fds[i]);
+			}
+			child= true;
+			Timestamp::startup= Timestamp::now();
+			Color::set();
+
+			/* The payload contains the working directory,
+			 * followed by the arguments, each terminated by
+			 * '\0' */
+			vector <char *> args;
+			for (size_t k= 0;  k < payload.size();) {
+				args.push_back(strdup(payload.c_str() + k));
+				k += strlen(payload.c_str() + k) + 1;
+			}
+			if (args.size() < 2 || strcmp(args[0], cwd)) {
+				print_error(fmt("Client must be run in the directory %s of the server",
+						name_format_word(cwd)));
+				exit(ERROR_FATAL);
+			}
+			dollar_zero= args[1];
+			argc= args.size() - 1;
+			args.push_back(nullptr);
+			argv= &args[1];
+			new vector <char *> (std::move(args));
+
+			if (stale)
+				parse(rule_first, place_first);
+			Change_Journal::reload();
+			return;
+		}
+
+		/* Parent */
+		for (int i= 0;  i < 3;  ++i)
+			close(fds[i]);
+
+		/* The client does not send anything else; when the
+		 * connection becomes readable, the client has terminated.
+		 * The termination of the child wakes up poll() through
+		 * FD_SIGCHLD.  */
+		int status;
+		pid_t r;
+		bool terminated= false;
+		while ((r= waitpid(pid, &status, terminated ? 0 : WNOHANG)) == 0
+		       || (r < 0 && errno == EINTR)) {
+			if (r < 0)
+				continue;
+			struct pollfd pfds[2];
+			pfds[0].fd= fd_sigchld[0];
+			pfds[0].events= POLLIN;
+			pfds[0].revents= 0;
+			pfds[1].fd= fd;
+			pfds[1].events= POLLIN;
+			pfds[1].revents= 0;
+			if (poll(pfds, 2, -1) < 0 && errno != EINTR) {
+				print_error_system("poll");
+				exit(ERROR_FATAL);
+			}
+			if (pfds[0].revents) {
+				char b[64];
+				while (read(fd_sigchld[0], b, sizeof(b)) > 0) ;
+			}
+			if (pfds[1].revents) {
+				kill(pid, SIGTERM);
+				terminated= true;
+			}
+		}
+		if (r < 0) {
+			print_error_system("waitpid");
+			exit(ERROR_FATAL);
+		}
+		send_status(fd, WIFEXITED(status)
+			    ? WEXITSTATUS(status) : ERROR_FATAL);
+		close(fd);
+
+		if (stale) {
+			reparse(rule_first, place_first);
+			stale= is_changed();
+		}
+	}
+}
+
+void Server::client(int argc, char **argv)
+{
+	/* The socket is given as "-USOCKET" or as "-U SOCKET" */
+	assert(argc >= 2 && ! strncmp(argv[1], "-U", 2));
+	const char *socket_name= argv[1] + 2;
+	int i_args= 2;
+	if (*socket_name == '\0' && argc >= 3)
+		socket_name= argv[i_args++];
+	if (*socket_name == '\0') {
+		Place(Place::Type::OPTION, 'U') << "expected a non-empty argument";
+		exit(ERROR_FATAL);
+	}
+
+	string payload;
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+		print_error_system("getcwd");
+		exit(ERROR_FATAL);
+	}
+	payload.append(cwd, strlen(cwd) + 1);
+	payload.append(argv[0], strlen(argv[0]) + 1);
+	for (int i= i_args;  i < argc;  ++i)
+		payload.append(argv[i], strlen(argv[i]) + 1);
+
+	/* A server that has gone away is reported as an error, and
+	 * the client does not execute anything */ 
+	signal(SIGPIPE, SIG_IGN);
+
+	int fd= socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family= AF_UNIX;
+	strncpy(addr.sun_path, socket_name, sizeof(addr.sun_path) - 1);
+	if (fd < 0 ||
+	    connect(fd, (const struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		print_error_system(socket_name);
+		exit(ERROR_FATAL);
+	}
+
+	/* The header is the magic string followed by the size of the
+	 * payload, and is sent together with the file descriptors */
+	char header[sizeof(SERVER_MAGIC) + sizeof(uint64_t)];
+	memcpy(header, SERVER_MAGIC, sizeof(SERVER_MAGIC));
+	uint64_t size= payload.size();
+	memcpy(header + sizeof(SERVER_MAGIC), &size, sizeof(size));
+	struct iovec iov;
+	iov.iov_base= header;
+	iov.iov_len= sizeof(header);
+	union {
+		struct cmsghdr align;
+		char b[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+	msg.msg_control= control.b;
+	msg.msg_controllen= sizeof(control.b);
+	struct cmsghdr *cmsg= CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level= SOL_SOCKET;
+	cmsg->cmsg_type= SCM_RIGHTS;
+	cmsg->cmsg_len= CMSG_LEN(3 * sizeof(int));
+	const int fds[3]= {0, 1, 2};
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(fd, &msg, 0) != (ssize_t) sizeof(header))
+		goto error;
+	for (size_t k= 0;  k < payload.size();) {
+		ssize_t r= send(fd, payload.c_str() + k, payload.size() - k, 0);
+		if (r < 0)
+			goto error;
+		k += r;
+	}
+
+	{
+		int32_t status;
+		size_t len= 0;
+		while (len < sizeof(status)) {
+			ssize_t r= read(fd, (char *) &status + len, sizeof(status) - len);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0)
+				goto error;
+			if (r == 0) {
+				print_error(fmt("Server on socket %s closed the connection",
+						name_format_word(socket_name)));
+				exit(ERROR_FATAL);
+			}
+			len += r;
+		}
+		exit(status);
+	}
+
+ error:
+	print_error_system(socket_name);
+	exit(ERROR_FATAL);
+}
+
+void Server::check_option(char option)
+{
+	if (! child)
+		return;
+	Place(Place::Type::OPTION, option) <<
+		fmt("cannot be used together with %s",
+		    multichar_format_word("-U"));
+	exit(ERROR_FATAL);
+}
+
+void Server::parse(shared_ptr <const Rule> &rule_first, Place &place_first)
+{
+	Execution::rule_set= Rule_Set();
+	rule_first= nullptr;
+	place_first= Place();
+	Tokenizer::sources.clear();
+	for (const auto &input:  inputs) {
+		if (input.first == 'F')
+			Parser::get_string(input.second.c_str(), Execution::rule_set, rule_first);
+		else
+			Parser::get_file(input.second, -1, Execution::rule_set,
+					 rule_first, place_first);
+	}
+}
+
+void Server::reparse(shared_ptr <const Rule> &rule_first, Place &place_first)
+{
+	Rule_Set rule_set_old= Execution::rule_set;
+	shared_ptr <const Rule> rule_first_old= rule_first;
+	Place place_first_old= place_first;
+
+	/* Errors are reported by the child process */
+	fflush(stderr);
+	int fd_err= dup(2);
+	int fd_null= open("/dev/null", O_WRONLY);
+	if (fd_err < 0 || fd_null < 0 || dup2(fd_null, 2) < 0) {
+		print_error_system("/dev/null");
+		exit(ERROR_FATAL);
+	}
+	close(fd_null);
+	bool success= true;
+	try {
+		parse(rule_first, place_first);
+	} catch (int e) {
+		success= false;
+	}
+	fflush(stderr);
+	dup2(fd_err, 2);
+	close(fd_err);
+
+	if (success) {
+		set_signatures();
+	} else {
+		Execution::rule_set= rule_set_old;
+		rule_first= rule_first_old;
+		place_first= place_first_old;
+	}
+}
+
+void Server::set_signatures()
+{
+	signatures.clear();
+	for (const string &filename:  Tokenizer::sources) {
+		Signature signature;
+		signature.filename= filename;
+		struct stat buf;
+		if (stat(filename.c_str(), &buf) < 0) {
+			/* A missing file is marked by a size of -1 */
+			signature.dev= 0;
+			signature.ino= 0;
+			signature.size= -1;
+		} else {
+			signature.dev= buf.st_dev;
+			signature.ino= buf.st_ino;
+			signature.size= buf.st_size;
+			signature.timestamp= Timestamp(&buf);
+		}
+		signatures.push_back(signature);
+	}
+}
+
+bool Server::is_changed()
+{
+	for (const Signature &signature:  signatures) {
+		struct stat buf;
+		if (stat(signature.filename.c_str(), &buf) < 0) {
+			if (signature.size != -1)
+				return true;
+			continue;
+		}
+		if (buf.st_dev != signature.dev ||
+		    buf.st_ino != signature.ino ||
+		    buf.st_size != signature.size ||
+		    Timestamp(&buf) < signature.timestamp ||
+		    signature.timestamp < Timestamp(&buf))
+			return true;
+	}
+	return false;
+}
+
+bool Server::is_peer_allowed(int fd)
+{
+#if defined(SO_PEERCRED) || HAVE_GETPEEREID
+	uid_t uid;
+#   ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len= sizeof(cred);
+	int r= getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len);
+	uid= cred.uid;
+#   else
+	gid_t gid;
+	int r= getpeereid(fd, &uid, &gid);
+#   endif
+	if (r < 0) {
+		print_error_system(name);
+		return false;
+	}
+	if (uid == geteuid())
+		return true;
+	print_error(frmt("Rejected request on socket %s from user ID %jd",
+			 name_format_word(name).c_str(), (intmax_t) uid));
+	return false;
+#else
+	/* Rely on the permissions of the socket */ 
+	(void) fd;
+	return true;
+#endif
+}
+
+void Server::handler_sigchld(int sig)
+{
+	/* [ASYNC-SIGNAL-SAFE] We use only async signal-safe functions here */
+	(void) sig;
+	int errno_save= errno;
+	if (write(fd_sigchld[1], "", 1) < 0) {
+		/* The pipe is full, i.e., poll() will return anyway */
+	}
+	errno= errno_save;
+}
+
+void Server::send_status(int fd, int32_t status)
+{
+	/* Ignore SIGPIPE only around send(), as child processes
+	 * inherit ignored signals */ 
+	struct sigaction act, act_old;
+	act.sa_handler= SIG_IGN;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags= 0;
+	sigaction(SIGPIPE, &act, &act_old);
+	send(fd, &status, sizeof(status), 0);
+	sigaction(SIGPIPE, &act_old, nullptr);
+}
+
+bool Server::receive(int fd, int fds[3], string &payload)
+/* Receive a request.  Return false on invalid requests.  */
+{
+	char header[sizeof(SERVER_MAGIC) + sizeof(uint64_t)];
+	struct iovec iov;
+	iov.iov_base= header;
+	iov.iov_len= sizeof(header);
+	union {
+		struct cmsghdr align;
+		char b[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+	msg.msg_control= control.b;
+	msg.msg_controllen= sizeof(control.b);
+	ssize_t r;
+	do r= recvmsg(fd, &msg, 0);
+	while (r < 0 && errno == EINTR);
+	if (r < 0)
+		return false;
+
+	/* Take the first three descriptors, and close all others that
+	 * the client may have sent */ 
+	bool have_fds= false;
+	for (struct cmsghdr *cmsg= CMSG_FIRSTHDR(&msg);  cmsg;
+	     cmsg= CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t count= (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i= 0;  i < count;  ++i) {
+			int fd_received;
+			memcpy(&fd_received, CMSG_DATA(cmsg) + i * sizeof(int),
+			       sizeof(int));
+			fcntl(fd_received, F_SETFD, FD_CLOEXEC);
+			if (! have_fds && count == 3)
+				fds[i]= fd_received;
+			else
+				close(fd_received);
+		}
+		if (count == 3)
+			have_fds= true;
+	}
+	if (! have_fds)
+		return false;
+
+	uint64_t size;
+	if (r != (ssize_t) sizeof(header) ||
+	    memcmp(header, SERVER_MAGIC, sizeof(SERVER_MAGIC)) ||
+	    (memcpy(&size, header + sizeof(SERVER_MAGIC), sizeof(size)),
+	     size > (1 << 30)))
+		goto invalid;
+	payload.resize(size);
+	for (size_t k= 0;  k < size;) {
+		r= read(fd, &payload[k], size - k);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			goto invalid;
+		k += r;
+	}
+	return true;
+
+ invalid:
+	for (int i= 0;  i < 3;  ++i)
+		close(fds[i]);
+	return false;
+}
+
+#endif /* ! SERVER_HH */
@@ -22,6 +22,8 @@ using namespace std;
 
 #include "dep.hh"
 #include "execution.hh" 
+#include "server.hh"
+#include "watch.hh"
 #include "rule.hh"
 #include "timestamp.hh"
 #include "color.hh"
@@ -41,7 +43,7 @@ using namespace std;
  * the platform:  GNU getopt() will all options to follow arguments,
  * while BSD getopt() does not. 
  */
-const char OPTIONS[]= "0:ac:C:dEf:F:ghij:JkKm:M:n:o:p:PqsVxyYz"; 
+const char OPTIONS[]= "0:aAc:C:dD:Ef:F:ghij:JkKlL:m:M:n:o:p:PqR:sS:u:U:VwxyYz"; 
 
 /* The output of the help (-h) option.  The following strings do not
  * contain tabs, but only space characters.  */   
@@ -52,9 +54,11 @@ const char HELP[]=
 	"Options:\n"						       
 	"  -0 FILENAME      Read \\0-separated file targets from the given file\n"
 	"  -a               Treat all trivial dependencies as non-trivial\n"          
+	"  -A               Write redirected output and content atomically\n"
 	"  -c FILENAME      Pass a target filename without Stu syntax parsing\n"      
 	"  -C EXPRESSIONS   Pass a target in full Stu syntax\n"		              
 	"  -d               Debug mode: show execution information on stderr\n"     
+	"  -D FILENAME      Cache parsed dynamic dependencies in the given file\n"
 	"  -E               Explain error messages\n"                                 
 	"  -f FILENAME      The input file to use instead of 'main.stu'\n"            
 	"  -F RULES         Pass rules in Stu syntax\n"                               
@@ -65,6 +69,8 @@ const char HELP[]=
 	"  -J               Disable Stu syntax in arguments\n"                        
 	"  -k               Keep on running after errors\n"		              
 	"  -K               Don't delete target files on error or interruption\n"     
+	"  -l               Recognize missing targets from directory listings\n"
+	"  -L JOURNAL       Only stat() files reported as changed in the given journal\n"
 	"  -m ORDER         Order to run the targets:\n"			      
 	"     dfs           (default) Depth-first order, like in Make\n"	      
 	"     random        Random order\n"				              
@@ -75,8 +81,13 @@ const char HELP[]=
 	"  -p FILENAME      Build a persistent dependency, i.e., ignore its timestamp\n"
 	"  -P               Print the rules and exit\n"                               
 	"  -q               Question mode: check whether targets are up to date\n"    
+	"  -R JOURNAL       Record changed files in the given journal and don't build\n"
 	"  -s               Silent mode: don't use stdout\n"
+	"  -S K             Call stat() in advance using K helper threads\n"
+	"  -u SOCKET        Read the rules once and serve requests on the given socket\n"
+	"  -U SOCKET        Pass the other arguments to the server on the given socket\n"
 	"  -V               Output version and exit\n"				      
+	"  -w               Watch mode: build again when files change\n"
 	"  -x               Output each line in a command individually\n"              
 	"  -y               Disable color in output\n"                                
 	"  -Y               Enable color in output\n"
@@ -136,6 +147,10 @@ int main(int argc, char **argv, char **envp)
 		exit(ERROR_FATAL); 
 	}
 
+	/* Client of the server mode */
+	if (argc >= 2 && ! strncmp(argv[1], "-U", 2))
+		Server::client(argc, argv);
+
 	try {
 		vector <string> filenames;
 		/* Filenames passed using the -f option.  Entries are
@@ -159,6 +174,12 @@ int main(int argc, char **argv, char **envp)
 
 		bool had_option_f= false; /* Both lower and upper case */
 
+		long threads_prefetch= 0;
+		/* The argument of -S.  The helper threads are started
+		 * just before the execution, i.e., in the server mode
+		 * and in the watch mode by the child process that
+		 * performs the build.  */
+
 		/* Parse $STU_OPTIONS */ 
 		const char *stu_options= getenv("STU_OPTIONS");
 		if (stu_options != NULL) {
@@ -174,7 +195,8 @@ int main(int argc, char **argv, char **envp)
 				}
 			}
 		}
-		
+
+	parse_arguments:
 		for (int c; (c= getopt(argc, argv, OPTIONS)) != -1;) {
 
 			if (stu_setting(c))
@@ -183,12 +205,14 @@ int main(int argc, char **argv, char **envp)
 			switch (c) {
 
 			case 'a': option_nontrivial= true;     break;
+			case 'A': option_atomic= true;         break;
 			case 'd': option_debug= true;          break;
 			case 'g': option_nonoptional= true;    break;
 			case 'h': fputs(HELP, stdout);         exit(0);
 			case 'J': option_literal= true;        break;
 			case 'k': option_keep_going= true;     break;
 			case 'K': option_no_delete= true;      break;
+			case 'l': option_list_dirs= true;      break;
 			case 'P': option_print= true;          break;  
 			case 'q': option_question= true;       break;
 
@@ -202,7 +226,7 @@ int main(int argc, char **argv, char **envp)
 				deps.push_back
 					(make_shared <Plain_Dep>
 					 (0, Place_Param_Target
-					  (0, Place_Name(optarg, place))));
+					  (0, Place_Name(Name::canonical(optarg), place))));
 				break;
 			}
 
@@ -212,6 +236,16 @@ int main(int argc, char **argv, char **envp)
 				break;
 			}
 
+			case 'D':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'D') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Server::check_option('D');
+				Dynamic_Cache::load(optarg); 
+				break;
+
 			case 'f':
 				if (*optarg == '\0') {
 					Place(Place::Type::OPTION, 'f') <<
@@ -219,18 +253,22 @@ int main(int argc, char **argv, char **envp)
 					exit(ERROR_FATAL);
 				}
 
+				Server::check_option('f');
 				for (string &filename:  filenames) {
 					/* Silently ignore duplicate input file on command line */
 					if (filename == optarg)  goto end;
 				}
 				had_option_f= true;
 				filenames.push_back(optarg); 
+				Server::add_input('f', optarg);
 				Parser::get_file(optarg, -1, Execution::rule_set, rule_first, place_first);
 			end:
 				break;
 
 			case 'F':
+				Server::check_option('F');
 				had_option_f= true;
+				Server::add_input('F', optarg);
 				Parser::get_string(optarg, Execution::rule_set, rule_first);
 				break;
 
@@ -261,6 +299,16 @@ int main(int argc, char **argv, char **envp)
 				break;
 			}
 
+			case 'L':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'L') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Server::check_option('L');
+				Change_Journal::load(optarg); 
+				break;
+
 			case 'm':
 				if (!strcmp(optarg, "random"))  {
 					order= Order::RANDOM;
@@ -304,7 +352,7 @@ int main(int argc, char **argv, char **envp)
 					  make_shared <Plain_Dep>
 					  (1 << flag_get_index(c), 
 					   Place_Param_Target
-					   (0, Place_Name(optarg, place)))));
+					   (0, Place_Name(Name::canonical(optarg), place)))));
 				break;
 			}
 
@@ -321,15 +369,60 @@ int main(int argc, char **argv, char **envp)
 				deps.push_back
 					(make_shared <Plain_Dep>
 					 (c == 'p' ? F_PERSISTENT : F_OPTIONAL, places,
-					  Place_Param_Target(0, Place_Name(optarg, place))));
+					  Place_Param_Target(0, Place_Name(Name::canonical(optarg), place))));
 				break; 
 			}
 
+			case 'R':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'R') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Server::check_option('R');
+				Change_Journal::record(optarg); 
+				break;
+
+			case 'S':  {
+				errno= 0;
+				char *endptr;
+				long threads= strtol(optarg, &endptr, 10);
+				Place place(Place::Type::OPTION, c); 
+				if (errno != 0 || *endptr != '\0') {
+					place << fmt("expected the number of threads, not %s",
+						     name_format_word(optarg)); 
+					exit(ERROR_FATAL); 
+				}
+				if (threads < 1) {
+					place << fmt("expected a positive number of threads, not %s",
+						     name_format_word(optarg));
+					exit(ERROR_FATAL); 
+				}
+				threads_prefetch= threads;
+				break;
+			}
+
+			case 'u':
+				Server::check_option('u');
+				Server::init(optarg);
+				break;
+
+			case 'U':
+				Place(Place::Type::OPTION, 'U') <<
+					"must be the first argument";
+				exit(ERROR_FATAL);
+
 			case 'V': 
 				fputs(VERSION_INFO, stdout); 
 				printf("USE_MTIM = %u\n", USE_MTIM); 
+				printf("HAVE_SWAPCONTEXT = %u\n", HAVE_SWAPCONTEXT); 
 				exit(0);
 
+			case 'w':
+				Server::check_option('w');
+				Watch::init();
+				break;
+
 			default:  
 				/* Invalid option -- an error message was
 				 * already printed by getopt() */   
@@ -343,6 +436,13 @@ int main(int argc, char **argv, char **envp)
 
 		order_vec= (order == Order::RANDOM);
 
+		if (Watch::enabled() && (Server::is_server() || Change_Journal::enabled())) {
+			Place(Place::Type::OPTION, 'w')
+				<< fmt("cannot be used together with %s",
+				       multichar_format_word(Server::is_server() ? "-u" : "-L")); 
+			exit(ERROR_FATAL); 
+		}
+
 		if (option_interactive && option_parallel) {
 			Place(Place::Type::OPTION, 'i')
 				<< fmt("parallel mode using %s cannot be used in interactive mode",
@@ -368,7 +468,7 @@ int main(int argc, char **argv, char **envp)
 			} else if (option_literal)
 				deps.push_back(make_shared <Plain_Dep> 
 					       (0, Place_Param_Target
-						(0, Place_Name(argv[i], place))));
+						(0, Place_Name(Name::canonical(argv[i]), place))));
 		}
 
 		if (! option_literal) {
@@ -376,10 +476,11 @@ int main(int argc, char **argv, char **envp)
 		} 
 
 		/* Use the default Stu script if -f/-F are not used */ 
-		if (! had_option_f) {
+		if (! had_option_f && ! Server::is_child()) {
 			filenames.push_back(FILENAME_INPUT_DEFAULT); 
 			int file_fd= open(FILENAME_INPUT_DEFAULT, O_RDONLY); 
 			if (file_fd >= 0) {
+				Server::add_input('f', "");
 				Parser::get_file("", file_fd, 
 						 Execution::rule_set, rule_first, place_first); 
 			} else {
@@ -407,6 +508,26 @@ int main(int argc, char **argv, char **envp)
 			exit(0); 
 		}
 
+		/* Server mode:  continue with the arguments of each
+		 * client in a child process */ 
+		if (Server::is_server()) {
+			if (! deps.empty() || had_option_target) {
+				Place(Place::Type::OPTION, 'u') <<
+					"targets must be passed by the client"; 
+				exit(ERROR_FATAL); 
+			}
+			Server::run(argc, argv, rule_first, place_first); 
+			deps.clear(); 
+			error= 0; 
+			/* Restart getopt() */ 
+#ifdef __GLIBC__
+			optind= 0;
+#else
+			optind= 1;
+#endif
+			goto parse_arguments; 
+		}
+
 		/* If no targets are given on the command line,
 		 * use the first non-variable target */ 
 		if (deps.empty() && ! had_option_target) {
@@ -432,6 +553,14 @@ int main(int argc, char **argv, char **envp)
 				(make_shared <Plain_Dep> (*(rule_first->place_param_targets[0])));  
 		}
 
+		if (Watch::enabled()) 
+			Watch::run(argv); 
+
+		/* Not before, because the threads would not survive
+		 * the fork() of the server and the watch mode */ 
+		if (threads_prefetch && ! Stat_Prefetch::enabled())
+			Stat_Prefetch::init(threads_prefetch); 
+
 		/* Execute */
 		Execution::main(deps);
 
@@ -445,6 +574,14 @@ int main(int argc, char **argv, char **envp)
 	 * Stu fails (but not for fatal errors).
 	 */
 	
+	if (Dynamic_Cache::enabled()) {
+		Dynamic_Cache::save(); 
+	}
+
+	if (Change_Journal::enabled()) {
+		Change_Journal::save(); 
+	}
+
 	if (option_statistics) {
 		Job::print_statistics();
 	}
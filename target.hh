@@ -405,6 +405,26 @@ public:
 					vector <size_t> &anchoring_b);
 	/* Whether anchoring A dominates anchoring B.  The anchorings do
 	 * not need to have the same number of parameters.  */
+
+	void canonicalize(bool begin= true, bool end= true);
+	/* Canonicalize the name in place, i.e., fold multiple slashes,
+	 * '.' and '..' components, and remove a trailing slash.  The
+	 * rules are not applied within or across parameters.  BEGIN
+	 * and END say whether the name is at the beginning and end of
+	 * the actual filename; they are false for parts of a
+	 * concatenation.  */
+
+	static void canonicalize_text(string &text, bool begin, bool end);
+	/* Canonicalize a single text element.  BEGIN and END say
+	 * whether TEXT starts and ends the name, i.e., is not adjacent
+	 * to a parameter or to a concatenated name.  Single pass,
+	 * without allocation.  */
+
+	static string canonical(string name) {
+		canonicalize_text(name, true, true);
+		return name; 
+	}
+	/* The canonical form of an unparametrized name */
 };
 
 class Param_Target
@@ -917,6 +937,119 @@ bool Name::valid(string &param_1, string &param_2) const
 	return true;
 }
 
+void Name::canonicalize(bool begin, bool end)
+{
+	assert(texts.size() == 1 + parameters.size());
+	const size_t n= get_n();
+	for (size_t i= 0;  i <= n;  ++i) {
+		canonicalize_text(texts[i], begin && i == 0, end && i == n);
+	}
+}
+
+void Name::canonicalize_text(string &text, bool begin, bool end)
+/*
+ * The output is never longer than the input, and is written into TEXT
+ * as it is read.  R is the read position and W the write position,
+ * with W <= R.  The output written so far always ends in a slash, or is
+ * empty.  The prefix up to FLOOR is never removed:  it is the root,
+ * i.e., one or two slashes, when BEGIN, and otherwise the text before
+ * the first slash, which belongs to the preceding parameter.  When not END, the
+ * text after the last slash belongs to the following parameter and is
+ * copied as is.  The slash after the last component may be virtual
+ * (W == N + 1), in which case it is never written.
+ */
+{
+	const size_t n= text.size();
+	char *const t= &text[0];
+
+	/* Names without slashes are already canonical */
+	if (n == 0 || memchr(t, '/', n) == nullptr)
+		return;
+
+	size_t r= 0, w;
+	bool absolute= false;
+	if (begin) {
+		while (r < n && t[r] == '/')
+			++r;
+		/* Exactly two slashes at the beginning are kept */
+		w= r == 2 ? 2 : r ? 1 : 0;
+		absolute= r != 0;
+	} else {
+		r= (const char *) memchr(t, '/', n) - t + 1;
+		w= r;
+	}
+	const size_t floor= w;
+
+	size_t lim= n;
+	if (! end) {
+		/* There is at least one slash */
+		lim= text.rfind('/') + 1;
+		if (lim < r)
+			lim= r;
+	}
+
+	while (r < lim) {
+		if (t[r] == '/') {
+			++r;
+			continue;
+		}
+		const char *q= (const char *) memchr(t + r, '/', lim - r);
+		const size_t e= q ? q - t : lim;
+		const size_t len= e - r;
+
+		if (len == 1 && t[r] == '.') {
+			/* Skip */
+		} else if (len == 2 && t[r] == '.' && t[r + 1] == '.') {
+			if (w > floor) {
+				/* Find the last component written */
+				size_t c= w - 1;
+				while (c > floor && t[c - 1] != '/')
+					--c;
+				if (w - 1 - c == 2 && t[c] == '.' && t[c + 1] == '.') {
+					t[w++]= '.';
+					t[w++]= '.';
+					if (w < n)  t[w]= '/';
+					++w;
+				} else {
+					w= c;
+				}
+			} else if (! absolute) {
+				t[w++]= '.';
+				t[w++]= '.';
+				if (w < n)  t[w]= '/';
+				++w;
+			}
+			/* Else, '/..' is the root itself */
+		} else {
+			if (w != r)
+				memmove(t + w, t + r, len);
+			w += len;
+			if (w < n)  t[w]= '/';
+			++w;
+		}
+		r= e;
+	}
+
+	if (end) {
+		if (w > floor) {
+			/* Remove the trailing slash */
+			--w;
+		} else if (begin) {
+			if (floor == 0)
+				t[w++]= '.';
+		} else {
+			/* Only the text before the first slash remains */
+			--w;
+		}
+	} else if (lim < n) {
+		memmove(t + w, t + lim, n - lim);
+		w += n - lim;
+	}
+
+	assert(w <= n);
+	text.resize(w);
+}
+
 bool Name::anchoring_dominates(vector <size_t> &anchoring_a,
 			       vector <size_t> &anchoring_b)
 /* (A) dominates (B) when every character in a parameter in (A) is also
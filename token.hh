@@ -13,6 +13,72 @@
 
 #include <memory>
 
+#include <stddef.h>
+
+class Token_Arena
+/* 
+ * Memory for the tokens of one tokenized input.  Tokens are allocated
+ * from large chunks and are never freed individually; all chunks are
+ * freed together when the last token allocated from them is destroyed.
+ * Thus, tokenizing a file needs O(1) heap allocations for the token
+ * objects, rather than one per token.  Used through Token_Allocator.
+ */
+{
+public:
+	~Token_Arena(); 
+
+	void *allocate(size_t size); 
+
+private:
+	static const size_t SIZE_CHUNK= 1 << 16; 
+
+	vector <char *> chunks; 
+
+	size_t used= SIZE_CHUNK;
+	/* Number of bytes used in the last chunk */ 
+};
+
+template <typename T>
+class Token_Allocator
+/* Allocator for use with allocate_shared().  The control block of each
+ * token holds a copy of the allocator, and therefore keeps the arena
+ * alive.  */
+{
+public:
+	typedef T value_type; 
+
+	shared_ptr <Token_Arena> arena; 
+
+	Token_Allocator(shared_ptr <Token_Arena> arena_)
+		:  arena(arena_)
+	{  }
+
+	template <typename U>
+	Token_Allocator(const Token_Allocator <U> &that)
+		:  arena(that.arena)
+	{  }
+
+	T *allocate(size_t n) {
+		return (T *) arena->allocate(n * sizeof(T)); 
+	}
+
+	void deallocate(T *, size_t) {
+		/* Memory is freed with the arena */ 
+	}
+};
+
+template <typename T, typename U>
+bool operator == (const Token_Allocator <T> &a, const Token_Allocator <U> &b) 
+{
+	return a.arena == b.arena; 
+}
+
+template <typename T, typename U>
+bool operator != (const Token_Allocator <T> &a, const Token_Allocator <U> &b) 
+{
+	return a.arena != b.arena; 
+}
+
 class Token
 /* A token.  This class is mainly used through unique_ptr/shared_ptr.  */
 {
@@ -125,10 +191,24 @@ class Name_Token
 	:  public Token, public Place_Name
 {
 public:
+	const bool slash;
+	/* Whether the name ended in a slash before it was canonicalized.
+	 * Used for copy rules.  */ 
+
 	Name_Token(const Place_Name &place_name_, 
-		   bool whitespace_) 
+		   bool whitespace_,
+		   bool slash_= false) 
+		:  Token(whitespace_),
+		   Place_Name(place_name_),
+		   slash(slash_)
+	{  }
+
+	Name_Token(Place_Name &&place_name_, 
+		   bool whitespace_,
+		   bool slash_= false) 
 		:  Token(whitespace_),
-		   Place_Name(place_name_)
+		   Place_Name(move(place_name_)),
+		   slash(slash_)
 	{  }
 
 	const Place &get_place() const {
@@ -188,6 +268,40 @@ public:
 	const vector <string> &get_lines() const;
 };
 
+Token_Arena::~Token_Arena()
+{
+	for (char *chunk:  chunks) 
+		free(chunk); 
+}
+
+void *Token_Arena::allocate(size_t size)
+{
+	/* Keep all allocations aligned */ 
+	size= (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1); 
+
+	/* Objects larger than a chunk get a chunk of their own, which is
+	 * inserted at the front so as not to replace the current chunk */ 
+	const bool large= size > SIZE_CHUNK; 
+
+	if (large || size > SIZE_CHUNK - used) {
+		char *chunk= (char *) malloc(large ? size : SIZE_CHUNK); 
+		if (! chunk) {
+			perror("malloc");
+			exit(ERROR_FATAL); 
+		}
+		if (large) {
+			chunks.insert(chunks.begin(), chunk); 
+			return chunk; 
+		}
+		chunks.push_back(chunk);
+		used= 0; 
+	}
+
+	void *ret= chunks.back() + used; 
+	used += size;
+	return ret; 
+}
+
 Token::~Token() { }
 
 Command::Command(string command_, 
@@ -17,6 +17,42 @@
 const char *const FILENAME_INPUT_DEFAULT= "main.stu"; 
 /* The default filename read  */
 
+class Char_Classes
+/* 
+ * Classification of all 256 byte values, as used by the tokenizer.  The
+ * table is computed once at startup from the character sets defined in
+ * Tokenizer.  The tokenizer then scans runs of name characters and of
+ * whitespace with one table lookup per byte, rather than one strchr()
+ * per byte, and appends whole runs at once.  
+ */
+{
+public:
+	enum {
+		NAME=      1 << 0,  /* Tokenizer::is_name_char() */
+		SPACE=     1 << 1,  /* isspace() in the C locale */ 
+		OPERATOR=  1 << 2   /* Tokenizer::is_operator_char() */
+	};
+
+	Char_Classes(); 
+
+	bool is(char c, unsigned char classes) const {
+		return table[(unsigned char) c] & classes; 
+	}
+
+	const char *skip(const char *p, const char *p_end, 
+			 unsigned char classes) const 
+	/* Return a pointer to the first character in [P, P_END) not in
+	 * CLASSES, or P_END. */ 
+	{
+		while (p < p_end && is(*p, classes))
+			++p;
+		return p; 
+	}
+
+private:
+	unsigned char table[256]; 
+};
+
 class Tokenizer
 {
 public:
@@ -70,6 +106,10 @@ public:
 	/* Parse tokens from the given TEXT.  Other arguments are
 	 * identical to parse_tokens_file().  */
 
+	static vector <string> sources;
+	/* The names of the Stu files that have been read, not including
+	 * standard input.  Used by the server mode to detect changes.  */
+
 private:
 
 	/* Stacks of included files */ 
@@ -98,6 +138,11 @@ private:
 	bool whitespace= true;
 	/* Whether there was whitespace previously */ 
 
+	Token_Allocator <Token> allocator; 
+	/* Operators, flags and names are allocated from a per-input
+	 * arena.  Commands are allocated individually, because they
+	 * live on in rules after the other tokens are discarded.  */
+
 	Tokenizer(vector <Trace> &traces_,
 		  vector <string> &filenames_,
 		  set <string> &includes_,
@@ -111,7 +156,8 @@ private:
 		   line(1),
 		   p_line(p_),
 		   p(p_),
-		   p_end(p_ + length)
+		   p_end(p_ + length),
+		   allocator(make_shared <Token_Arena> ())
 	{ }
 
 	void parse_tokens(vector <shared_ptr <Token> > &tokens, 
@@ -120,9 +166,11 @@ private:
 
 	shared_ptr <Command> parse_command();
 	
-	shared_ptr <Place_Name> parse_name(bool allow_special);
-	/* Returns null when no name could be parsed.  Prints and throws
-	 * on other errors, including on empty names.  
+	bool parse_name(Place_Name &ret, bool allow_special);
+	/* Parse a name into RET, which must be empty and have its place
+	 * set to the current place.  Returns false when no name could
+	 * be parsed.  Prints and throws on other errors, including on
+	 * empty names.  
 	 * ALLOW_SPECIAL:  whether the name is allowed to start with one of '-+~'.  */ 
 
 	bool parse_parameter(string &parameter, Place &place_dollar); 
@@ -148,9 +196,7 @@ private:
 	void skip_space(); 
 
 	Place current_place() const {
-		return Place(place_base.type,
-			     place_base.text,
-			     line, p - p_line); 
+		return Place(place_base, line, p - p_line); 
 	}
 
 	static void parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
@@ -185,6 +231,8 @@ private:
 	static bool is_operator_char(char);
 	/* Whether the character can be an operator */ 
 
+	static const Char_Classes char_classes; 
+
 	static void parse_version(string version_req, 
 				  const Place &place_version,
 				  const Place &place_percent); 
@@ -192,6 +240,25 @@ private:
 	 * given after "%version", and PLACE its place.  */
 };
 
+const Char_Classes Tokenizer::char_classes;
+vector <string> Tokenizer::sources;
+
+Char_Classes::Char_Classes()
+{
+	for (unsigned i= 0;  i < 256;  ++i) {
+		const char c= (char) i;
+		table[i]= 0;
+		if ((c > 0x20 && c < 0x7F /* ASCII printable character except space */ 
+		     && nullptr == strchr("[]\"\':={}#<>@$;()%*\\!?|&,", c))
+		    || i >= 0x80)
+			table[i] |= NAME;
+		if (c != '\0' && nullptr != strchr(" \n\t\f\r\v", c))
+			table[i] |= SPACE;
+		if (c != '\0' && nullptr != strchr(":<>=@;()[],\\|", c))
+			table[i] |= OPERATOR; 
+	}
+}
+
 void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
 				  Context context,
 				  Place &place_end,
@@ -263,6 +330,9 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 				goto error_close;
 		}
 
+		if (context == SOURCE && file == nullptr)
+			sources.push_back(filename); 
+
 		/* Handle a file of zero length separately because mmap() may fail
 		 * on it, i.e., return an error and refuse to create a memory
 		 * map of length zero. */  
@@ -520,8 +590,7 @@ shared_ptr <Command> Tokenizer::parse_command()
 					const string command= string(p_beg, p - p_beg);
 					++p;
 					const Place place_command
-						(place_base.type, place_base.text,
-						 line_command, column_command); 
+						(place_base, line_command, column_command); 
 					return make_shared <Command> 
 						(command, place_command, place_open, whitespace); 
 				} else {
@@ -642,39 +711,39 @@ shared_ptr <Command> Tokenizer::parse_command()
 	throw ERROR_LOGICAL;
 }
 
-shared_ptr <Place_Name> Tokenizer::parse_name(bool allow_special)
+bool Tokenizer::parse_name(Place_Name &ret, bool allow_special)
 {
 	const char *const p_begin= p; 
-	Place place_begin= current_place(); 
-
-	shared_ptr <Place_Name> ret= make_shared <Place_Name> ("", place_begin);
+	assert(ret.empty()); 
 
 	/* Don't allow '-', '+' and '~' at beginning of a name */
 	if (p < p_end && ! allow_special) {
 		if (*p == '-' || *p == '+' || *p == '~') {
-			return nullptr;
+			return false;
 		}
 	}
 
 	while (p < p_end) {
 		if (*p == '"') {
-			parse_double_quote(*ret); 
+			parse_double_quote(ret); 
 		} else if (*p == '\'') {
-			parse_single_quote(*ret); 
+			parse_single_quote(ret); 
 		} else if (*p == '$') {
 			string parameter;
 			Place place_dollar;
 			if (parse_parameter(parameter, place_dollar)) {
-				ret->append_parameter(parameter, place_dollar);
+				ret.append_parameter(parameter, place_dollar);
 			} else {
 				assert(false); 
 			}
 		} else if (is_name_char(*p)) {
-			/* An ordinary character */ 
+			/* A run of ordinary characters */ 
 			assert(p != p_begin 
 			       || (*p != '-' && *p != '+' && *p != '~')
 			       || allow_special);
-			ret->last_text() += *p++;
+			const char *const p_run= p;
+			p= char_classes.skip(p, p_end, Char_Classes::NAME); 
+			ret.last_text().append(p_run, p - p_run);
 		}
 		else {
 			/* As soon as the name cannot be parsed
@@ -683,14 +752,14 @@ shared_ptr <Place_Name> Tokenizer::parse_name(bool allow_special)
 		}	
 	}
 
-	if (ret->empty()) {
+	if (ret.empty()) {
 		if (p == p_begin)
-			return nullptr; 
-		place_begin << "name must not be empty";
+			return false; 
+		ret.place << "name must not be empty";
 		throw ERROR_LOGICAL;
 	}
 
-	return ret;
+	return true;
 }
 
 bool Tokenizer::parse_parameter(string &parameter, Place &place_dollar)
@@ -762,27 +831,25 @@ bool Tokenizer::parse_parameter(string &parameter, Place &place_dollar)
 }
 
 bool Tokenizer::is_name_char(char c) 
-/* The characters in the string constant are those characters that have
- * special meaning (as defined in the manpage), and those reserved for
- * future extension (also defined in the manpage)  */
+/* The characters excluded in Char_Classes::Char_Classes() are those
+ * characters that have special meaning (as defined in the manpage), and
+ * those reserved for future extension (also defined in the manpage)  */
 {
-	return (c > 0x20 && c < 0x7F /* ASCII printable character except space */ 
-		&& nullptr == strchr("[]\"\':={}#<>@$;()%*\\!?|&,", c))
-		|| ((unsigned char) c) >= 0x80;
+	return char_classes.is(c, Char_Classes::NAME); 
 }
 
 bool Tokenizer::is_operator_char(char c) 
 {
-	return c != '\0' && nullptr != strchr(":<>=@;()[],\\|", c);
+	return char_classes.is(c, Char_Classes::OPERATOR); 
 }
 
 bool Tokenizer::is_flag_char(char c)
-/* These correspond to persistent, optional and trivial dependencies,
- * respectively.  'p'/'o'/'t' were '!', '?' and '&' formerly.  The
- * others are new.  */
+/* The first three correspond to persistent, optional and trivial
+ * dependencies, respectively.  'p'/'o'/'t' were '!', '?' and '&'
+ * formerly.  The others are new.  */
 {
 	return c == 'p' || c == 'o' || c == 't' || 
-		c == 'n' || c == '0';
+		c == 'n' || c == '0' || c == 'd' || c == 's';
 }
 
 void Tokenizer::parse_version(string version_req, 
@@ -855,17 +922,16 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 		/* Operators except '$' */ 
 		if (is_operator_char(*p)) {
 			Place place= current_place(); 
-			tokens.push_back(make_shared <Operator> (*p, place, whitespace));
+			tokens.push_back(allocate_shared <Operator> (allocator, *p, place, whitespace));
 			++p;
 		}
 
 		/* Variable dependency */ 
 		else if (*p == '$' && p + 1 < p_end && p[1] == '[') {
 			Place place_dollar= current_place(); 
-			Place place_langle(place_base.type, place_base.text,
-					   line, p + 1 - p_line);
-			tokens.push_back(make_shared <Operator> ('$', place_dollar, whitespace));
-			tokens.push_back(make_shared <Operator> ('[', place_langle, whitespace)); 
+			Place place_langle(place_base, line, p + 1 - p_line);
+			tokens.push_back(allocate_shared <Operator> (allocator, '$', place_dollar, whitespace));
+			tokens.push_back(allocate_shared <Operator> (allocator, '[', place_langle, whitespace)); 
 			p += 2;
 		}
 
@@ -878,18 +944,14 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 		/* Comment */ 
 		else if (*p == '#') {
 			/* Skip the comment without generating any token */ 
-			do  ++p;  while (p < p_end && *p != '\n');
+			p= (const char *) memchr(p, '\n', p_end - p);
+			if (p == nullptr)
+				p= p_end; 
 		} 
 
 		/* Whitespace */
-		else if (isspace(*p)) { 
-			do {
-				if (*p == '\n') {
-					++line;  
-					p_line= p + 1; 
-				}
-				++p; 
-			} while (p < p_end && isspace(*p));
+		else if (char_classes.is(*p, Char_Classes::SPACE)) { 
+			skip_space(); 
 			whitespace= true;
 			goto had_whitespace; 
 		} 
@@ -946,8 +1008,8 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 					throw ERROR_LOGICAL; 
 				}
 				assert(isalnum(op)); 
-				shared_ptr <Flag_Token> token= make_shared <Flag_Token> 
-					(op, current_place(), whitespace); 
+				shared_ptr <Flag_Token> token= allocate_shared <Flag_Token> 
+					(allocator, op, current_place(), whitespace); 
 				tokens.push_back(token); 
 				++p;
 				if (p < p_end && 
@@ -963,8 +1025,8 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 				}
 			} else {
 
-			shared_ptr <Place_Name> place_name= parse_name(allow_special);
-			if (place_name == nullptr) {
+			Place_Name place_name("", current_place()); 
+			if (! parse_name(place_name, allow_special)) {
 				if (*p == '!') {
 					current_place() <<
 						fmt("character %s is invalid for persistent dependencies; use %s instead",
@@ -988,9 +1050,19 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 				}
 				throw ERROR_LOGICAL;
 			}
-			assert(! place_name->empty());
-			tokens.push_back(make_shared <Name_Token>
-					 (*place_name, whitespace)); 
+			assert(! place_name.empty());
+
+			/* Canonicalize the name.  A name that is part
+			 * of a concatenation is only canonicalized
+			 * partially; the full name is canonicalized
+			 * when the concatenation is performed.  */
+			const bool slash= place_name.last_text().size() != 0
+				&& place_name.last_text().back() == '/'; 
+			place_name.canonicalize
+				(! allow_special,
+				 ! (p < p_end && (*p == '[' || *p == '('))); 
+			tokens.push_back(allocate_shared <Name_Token>
+					 (allocator, move(place_name), whitespace, slash)); 
 			}
 		}
 		
@@ -1021,7 +1093,7 @@ void Tokenizer::parse_tokens_string(vector <shared_ptr <Token> > &tokens,
 
 void Tokenizer::skip_space()
 {
-	while (p < p_end && isspace(*p)) {
+	while (p < p_end && char_classes.is(*p, Char_Classes::SPACE)) {
 		if (*p == '\n') {
 			++line;  
 			p_line= p + 1; 
@@ -1184,9 +1256,9 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 			throw ERROR_LOGICAL;
 		}
 
-		shared_ptr <Place_Name> place_name= parse_name(false); 
+		Place_Name place_name("", current_place()); 
 
-		if (place_name == nullptr) {
+		if (! parse_name(place_name, false)) {
 			current_place() <<
 				(p == p_end
 				 ? "expected a filename"
@@ -1196,24 +1268,24 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 			throw ERROR_LOGICAL;
 		}
 				
-		if (place_name->get_n() != 0) {
-			place_name->place <<
+		if (place_name.get_n() != 0) {
+			place_name.place <<
 				fmt("name %s must not be parametrized",
-				    place_name->format_word());
+				    place_name.format_word());
 			place_percent << frmt("after %s%%include%s",
 					      Color::word, Color::end); 
 			throw ERROR_LOGICAL;
 		}
 			
-		const string filename_include= place_name->unparametrized();
+		const string filename_include= place_name.unparametrized();
 
 		Trace trace_stack
-			(place_name->place,
+			(place_name.place,
 			 fmt("%s is included from here", 
 			     name_format_word(filename_include))); 
 
 		traces.push_back(trace_stack);
-		filenames.push_back(place_base.text); 
+		filenames.push_back(place_base.get_text()); 
 
 		if (includes.count(filename_include)) {
 			/* Do nothing -- file was already parsed, or is
@@ -1256,20 +1328,11 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 		filenames.pop_back(); 
 
 	} else if (name == "version") {
-		while (p < p_end && isspace(*p)) {
-			if (*p == '\n') {
-				++line;  
-				p_line= p + 1; 
-			}
-			++p; 
-		}
+		skip_space(); 
 		const char *const p_version= p;
-		while (p < p_end && is_name_char(*p)) {
-			++p;
-		}
+		p= char_classes.skip(p, p_end, Char_Classes::NAME); 
 		const string version_required(p_version, p - p_version); 
-		Place place_version(place_base.type, place_base.text,
-				    line, p_version - p_line); 
+		Place place_version(place_base, line, p_version - p_line); 
 
 		parse_version(version_required, place_version, place_percent); 
 				
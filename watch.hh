@@ -0,0 +1,234 @@
+#ifndef WATCH_HH
+#define WATCH_HH
+
+/*
+ * The watch mode, enabled with the -w option.  Stu builds the targets,
+ * and then keeps running, and builds them again whenever one of the
+ * files it has checked changes.  The current directory tree is watched
+ * using inotify, in the same way as by the watcher of the change
+ * journal (-R).
+ *
+ * Each build is performed by a child process, which starts from the
+ * rules that were read once.  The results of stat() are kept by the
+ * watching process between builds, as in the snapshot of the change
+ * journal, and each child only calls stat() on files that have changed
+ * since the previous build.  The child passes its results back through
+ * a pipe when it exits.
+ *
+ * A file is considered changed only when stat() gives another result
+ * than the one seen by the last build.  In particular, files written
+ * by the build itself do not trigger a new build, and changes made
+ * while a build is running are seen.  Changes are collected until no
+ * further change happens for a short time, such that a burst of
+ * changes leads to a single build.  When a Stu file is changed, Stu
+ * executes itself again.
+ *
+ * Like the change journal, only files within the current directory
+ * that are not reached through symbolic links are watched.
+ */
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "journal.hh"
+
+class Watch
+{
+public:
+	static void init();
+	/* Called when the -w option is processed */
+
+	static bool enabled() {  return is_enabled;  }
+
+	static void run(char **argv);
+	/* Build in a child process each time files have changed.
+	 * Returns only in the child process, which then performs the
+	 * build.  ARGV are the arguments of Stu, used to execute Stu
+	 * again when a Stu file has changed.  */
+
+private:
+	struct Signature {
+		string filename;
+		struct stat buf;
+		int ret;
+	};
+
+	static const int DEBOUNCE_MS= 100;
+	/* Time without changes before a build is started */
+
+	static bool is_enabled;
+
+	static bool process(int fd_inotify, unordered_map <int, string> &watches);
+	/* Process all available events.  Return whether one of the
+	 * saved files has changed.  */
+
+	static bool is_changed(const vector <Signature> &signatures);
+
+	static int64_t get_time();
+	/* In milliseconds, from a monotonic clock */
+};
+
+bool Watch::is_enabled= false;
+
+void Watch::init()
+{
+#if HAVE_INOTIFY
+	is_enabled= true;
+#else
+	Place(Place::Type::OPTION, 'w') <<
+		"watching files is not supported on this platform";
+	exit(ERROR_FATAL);
+#endif
+}
+
+void Watch::run(char **argv)
+{
+#if HAVE_INOTIFY
+	/* The Stu files that were read */
+	vector <Signature> signatures;
+	for (const string &filename:  Tokenizer::sources) {
+		Signature signature;
+		signature.filename= filename;
+		signature.ret= ::stat(filename.c_str(), &signature.buf);
+		signatures.push_back(signature);
+	}
+
+	int fd_inotify= inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (fd_inotify < 0) {
+		print_error_system("inotify_init1");
+		exit(ERROR_FATAL);
+	}
+	unordered_map <int, string> watches;
+	Change_Journal::watch_tree(fd_inotify, watches, "");
+	Change_Journal::init_memory();
+
+	for (;;) {
+		/* Changes made before this point are seen by the build */
+		process(fd_inotify, watches);
+
+		int fd_pipe[2];
+		if (pipe(fd_pipe) < 0) {
+			print_error_system("pipe");
+			exit(ERROR_FATAL);
+		}
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid= fork();
+		if (pid < 0) {
+			print_error_system("fork");
+			exit(ERROR_FATAL);
+		}
+		if (pid == 0) {
+			close(fd_inotify);
+			close(fd_pipe[0]);
+			fcntl(fd_pipe[1], F_SETFD, FD_CLOEXEC);
+			Change_Journal::set_output(fd_pipe[1]);
+			Timestamp::startup= Timestamp::now();
+			return;
+		}
+
+		close(fd_pipe[1]);
+		Change_Journal::read_entries(fd_pipe[0]);
+		close(fd_pipe[0]);
+		int status;
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				print_error_system("waitpid");
+				exit(ERROR_FATAL);
+			}
+		}
+
+		/* Wait for a change, and then until there are no more
+		 * changes for DEBOUNCE_MS milliseconds.  Other events do
+		 * not delay the build.  */
+		bool changed= process(fd_inotify, watches);
+		int64_t time_change= get_time();
+		struct pollfd pfd;
+		pfd.fd= fd_inotify;
+		pfd.events= POLLIN;
+		while (! is_changed(signatures)) {
+			int timeout= -1;
+			if (changed) {
+				timeout= time_change + DEBOUNCE_MS - get_time();
+				if (timeout <= 0)
+					break;
+			}
+			int r= poll(&pfd, 1, timeout);
+			if (r < 0 && errno != EINTR) {
+				print_error_system("poll");
+				exit(ERROR_FATAL);
+			}
+			if (r > 0 && process(fd_inotify, watches)) {
+				changed= true;
+				time_change= get_time();
+			}
+		}
+
+		if (is_changed(signatures)) {
+			fflush(stdout);
+			fflush(stderr);
+			execvp(argv[0], argv);
+			print_error_system(argv[0]);
+			exit(ERROR_FATAL);
+		}
+	}
+#else /* ! HAVE_INOTIFY */
+	(void) argv;
+	assert(false);
+#endif /* ! HAVE_INOTIFY */
+}
+
+bool Watch::process(int fd_inotify, unordered_map <int, string> &watches)
+{
+	bool changed= false;
+#if HAVE_INOTIFY
+	vector <string> lines;
+	for (;;) {
+		size_t size_old= lines.size();
+		Change_Journal::read_events(fd_inotify, watches, lines);
+		if (lines.size() == size_old)
+			break;
+	}
+	/* A file that is being written gives many events */
+	unordered_set <string> lines_done;
+	for (const string &line:  lines) {
+		if (lines_done.insert(line).second &&
+		    Change_Journal::invalidate(line))
+			changed= true;
+	}
+#else
+	(void) fd_inotify;
+	(void) watches;
+#endif
+	return changed;
+}
+
+bool Watch::is_changed(const vector <Signature> &signatures)
+{
+	for (const Signature &signature:  signatures) {
+		struct stat buf;
+		int ret= ::stat(signature.filename.c_str(), &buf);
+		if (ret != signature.ret)
+			return true;
+		if (ret < 0)
+			continue;
+		if (buf.st_ino != signature.buf.st_ino ||
+		    buf.st_size != signature.buf.st_size ||
+		    Timestamp(&buf) < Timestamp(&signature.buf) ||
+		    Timestamp(&signature.buf) < Timestamp(&buf))
+			return true;
+	}
+	return false;
+}
+
+int64_t Watch::get_time()
+{
+	struct timespec t;
+	if (clock_gettime(CLOCK_MONOTONIC, &t) < 0) {
+		print_error_system("clock_gettime");
+		exit(ERROR_FATAL);
+	}
+	return (int64_t) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+#endif /* ! WATCH_HH */